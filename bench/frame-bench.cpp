@@ -0,0 +1,79 @@
+/**
+ * Benchmark of per-LED scalar state evaluation against the packed frame evaluator
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "../frame.hpp"
+
+enum led_action_t { LED_ON, LED_OFF, LED_BLINK };
+
+struct Led {
+    led_action_t action;
+    int blink_interval_ms;
+    int phase_ms;
+};
+
+// the service's original per-LED evaluation, called once per LED per tick
+__attribute__((noinline)) bool get_expected_led_state(const Led& led, uint64_t now_ms)
+{
+    if (led.action == LED_ON) return true;
+    if (led.action == LED_OFF) return false;
+    //else
+    return ((now_ms + led.phase_ms) / led.blink_interval_ms) % 2 == 0;
+}
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    std::cout << std::setw(8) << "LEDs" << std::setw(16) << "scalar ns/frame" << std::setw(16) << "packed ns/frame" << std::setw(10) << "speedup" << std::endl;
+    uint64_t sink = 0;
+    for (size_t n : {64, 512, 4096}) {
+        std::vector<Led> leds;
+        frame::Evaluator evaluator;
+        for (size_t i = 0; i < n; i++) {
+            auto action = i % 5 == 0? LED_ON : i % 7 == 0? LED_OFF : LED_BLINK;
+            int interval = 100 + i % 400, phase = i * 37 % (2 * interval);
+            leds.push_back({action, interval, phase});
+            evaluator.add(action == LED_ON? frame::Pattern::on() : action == LED_OFF? frame::Pattern::off() : frame::Pattern::blink(interval, phase));
+        }
+        std::vector<uint64_t> scalar_bits(evaluator.words()), packed_bits(evaluator.words());
+
+        // both evaluators must agree
+        for (uint32_t t = 0; t < 100000; t += 7) {
+            std::fill(scalar_bits.begin(), scalar_bits.end(), 0);
+            for (size_t i = 0; i < n; i++) scalar_bits[i / 64] |= (uint64_t)get_expected_led_state(leds[i], t) << (i % 64);
+            evaluator.evaluate(t, packed_bits.data());
+            for (size_t i = 0; i < n; i++) {
+                // accumulator rounding may move an edge by a millisecond
+                if (frame::get_bit(scalar_bits.data(), i) != frame::get_bit(packed_bits.data(), i)) {
+                    auto before = get_expected_led_state(leds[i], t - 1), after = get_expected_led_state(leds[i], t + 1);
+                    if (before == after) {
+                        std::cerr << "mismatch at LED " << i << ", t=" << t << std::endl;
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        const int frames = 4000000 / n;
+        auto start = clock::now();
+        for (int f = 0; f < frames; f++) {
+            std::fill(scalar_bits.begin(), scalar_bits.end(), 0);
+            for (size_t i = 0; i < n; i++) scalar_bits[i / 64] |= (uint64_t)get_expected_led_state(leds[i], f) << (i % 64);
+            sink += scalar_bits[0];
+        }
+        auto scalar_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / frames;
+        start = clock::now();
+        for (int f = 0; f < frames; f++) {
+            evaluator.evaluate(f, packed_bits.data());
+            sink += packed_bits[0];
+        }
+        auto packed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / frames;
+        std::cout << std::setw(8) << n << std::setw(16) << std::fixed << std::setprecision(1) << scalar_ns
+            << std::setw(16) << packed_ns << std::setw(9) << scalar_ns / packed_ns << "x" << std::endl;
+    }
+    return sink == 42;  // keep the results alive
+}
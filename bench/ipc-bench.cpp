@@ -0,0 +1,80 @@
+/**
+ * Benchmark of the control interfaces: connection setup plus first call, and per-call latency of get,
+ * over D-Bus and over Varlink.  Needs a running service, e.g. `led-indicator --varlink service`; a
+ * transport that cannot be reached is skipped.  Built with -DNO_DBUS, it measures Varlink only.
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#ifndef NO_DBUS
+#include <sdbus-c++/sdbus-c++.h>
+#endif
+
+#include "../varlink.hpp"
+
+#ifndef NO_DBUS
+const char* serviceName = "com.walbrix.LedIndicatorService";
+const char* objectPath = "/com/walbrix/LedIndicator";
+#endif
+const char* interfaceName = "com.walbrix.LedIndicator";
+const char* varlink_socket = "/run/com.walbrix.LedIndicator";
+
+void report(const std::string& name, const std::function<void()>& connect_and_call, const std::function<void()>& call)
+{
+    using clock = std::chrono::steady_clock;
+    const int connects = 50, calls = 2000;
+    try {
+        std::vector<double> setup_us;
+        for (int i = 0; i < connects; i++) {
+            auto start = clock::now();
+            connect_and_call();
+            setup_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        }
+        std::vector<double> call_us;
+        for (int i = 0; i < calls; i++) {
+            auto start = clock::now();
+            call();
+            call_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        }
+        auto median = [](std::vector<double>& v) { std::sort(v.begin(), v.end()); return v[v.size() / 2]; };
+        auto p99 = [](std::vector<double>& v) { std::sort(v.begin(), v.end()); return v[v.size() * 99 / 100]; };
+        std::cout << std::setw(10) << name << std::fixed << std::setprecision(1)
+            << std::setw(16) << median(setup_us) << std::setw(14) << median(call_us) << std::setw(14) << p99(call_us) << std::endl;
+    }
+    catch (const std::exception& err) {
+        std::cout << std::setw(10) << name << "  skipped (" << err.what() << ")" << std::endl;
+    }
+}
+
+int main()
+{
+    std::cout << std::setw(10) << "transport" << std::setw(16) << "connect+get us" << std::setw(14) << "get us (p50)" << std::setw(14) << "get us (p99)" << std::endl;
+
+#ifndef NO_DBUS
+    std::unique_ptr<sdbus::IProxy> proxy;
+    report("D-Bus", []() {
+        std::string action;
+        sdbus::createProxy(serviceName, objectPath)->callMethod("get").onInterface(interfaceName).storeResultsTo(action);
+    }, [&]() {
+        if (!proxy) proxy = sdbus::createProxy(serviceName, objectPath);
+        std::string action;
+        proxy->callMethod("get").onInterface(interfaceName).storeResultsTo(action);
+    });
+#endif
+
+    std::unique_ptr<varlink::Client> client;
+    const std::string method = std::string(interfaceName) + ".Get";
+    report("Varlink", [&]() {
+        varlink::Client(varlink_socket).call(method);
+    }, [&]() {
+        if (!client) client = std::make_unique<varlink::Client>(varlink_socket);
+        client->call(method);
+    });
+    return 0;
+}
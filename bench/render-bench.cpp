@@ -0,0 +1,58 @@
+/**
+ * Benchmark of strip frame rendering on one thread against the work-stealing pool
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "../render.hpp"
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    const size_t pixels = 8192, frames = 500;
+    std::vector<render::Effect> effects;
+    for (uint32_t first = 0; first < pixels; first += 1024) {
+        effects.push_back(*render::Effect::parse(first, "gradient=1024,#ff0000,#0000ff"));
+        effects.push_back(*render::Effect::parse(first, "chase=1024,#00ff00,1500"));
+        effects.push_back(*render::Effect::parse(first + 512, "bar=512,#ffffff,40"));
+    }
+    std::vector<uint64_t> bits(pixels / 64, 0x8000000000000001ULL);
+    const std::array<uint8_t, 3> on = {255, 255, 255};
+    std::vector<uint8_t> expected(pixels * 3), grb(pixels * 3);
+
+    std::cout << pixels << " pixels, " << effects.size() << " effects" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "us/frame" << std::setw(10) << "speedup" << std::setw(14) << "steals/frame" << std::endl;
+    double single_us = 0;
+    std::vector<size_t> thread_counts = {1, 2, 4};
+    if (std::thread::hardware_concurrency() > 4) thread_counts.push_back(std::thread::hardware_concurrency());
+    for (size_t threads : thread_counts) {
+        render::WorkerPool pool(threads);
+        uint64_t t_ms = 0;
+        const render::WorkerPool::Job job = [&](size_t begin, size_t end) {
+            render::render_range(effects, bits.data(), on, t_ms, begin, end, grb.data());
+        };
+        // the pool must produce the same frame as a single pass
+        for (t_ms = 0; t_ms < 3000; t_ms += 250) {
+            render::render_range(effects, bits.data(), on, t_ms, 0, pixels, expected.data());
+            pool.run(pixels, 256, job);
+            if (grb != expected) {
+                std::cerr << "mismatch at t=" << t_ms << " with " << threads << " threads" << std::endl;
+                return 1;
+            }
+        }
+        auto steals = pool.get_steals();
+        auto start = clock::now();
+        for (size_t i = 0; i < frames; i++) {
+            t_ms = i * 16;
+            pool.run(pixels, 256, job);
+        }
+        double us = std::chrono::duration<double, std::micro>(clock::now() - start).count() / frames;
+        if (threads == 1) single_us = us;
+        std::cout << std::setw(8) << pool.size() << std::setw(14) << std::fixed << std::setprecision(1) << us
+            << std::setw(9) << std::setprecision(2) << single_us / us << "x"
+            << std::setw(14) << std::setprecision(1) << (double)(pool.get_steals() - steals) / frames << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * Benchmark of RGB PWM colour mixing: resolution and CPU cost per bit depth, with and without dithering
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <set>
+#include <cmath>
+
+#include "../rgb.hpp"
+
+double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    const unsigned pwm_hz = 200, window = 20;  // output averaged over 100ms, roughly what the eye integrates
+    const rgb::GammaLut lut(2.2);
+    std::cout << pwm_hz << "Hz PWM, resolution over " << window << " periods, CPU running a dim orange (#ff3008)" << std::endl;
+    std::cout << std::setw(6) << "bits" << std::setw(8) << "dither" << std::setw(12) << "levels/256" << std::setw(12) << "max error"
+        << std::setw(12) << "writes/s" << std::setw(10) << "CPU %" << std::endl;
+    for (unsigned bits : {4, 6, 8, 10, 12}) {
+        for (bool dither : {false, true}) {
+            // how many of the 256 input values stay distinguishable, and the worst deviation from the LUT
+            std::set<uint64_t> outputs;
+            double max_error = 0;
+            for (int v = 0; v < 256; v++) {
+                rgb::Modulator modulator(bits, dither);
+                std::array<uint32_t, 3> levels = {lut[v], 0, 0}, duties;
+                uint64_t sum = 0;
+                for (unsigned i = 0; i < window; i++) {
+                    modulator.next(levels, duties);
+                    sum += duties[0];
+                }
+                outputs.insert(sum);
+                double average = (double)sum / window * (rgb::full_level >> bits);
+                max_error = std::max(max_error, std::abs(average - levels[0]));
+            }
+
+            // real-time PWM for half a second with a no-op write
+            rgb::Modulator modulator(bits, dither);
+            std::array<uint32_t, 3> levels = {lut[0xff], lut[0x30], lut[0x08]}, duties;
+            std::array<bool, 3> on = {false, false, false};
+            auto period = std::chrono::nanoseconds(std::chrono::seconds(1)) / pwm_hz;
+            uint64_t writes = 0;
+            auto cpu_start = thread_cpu_seconds();
+            auto start = clock::now(), deadline = start;
+            for (unsigned i = 0; i < pwm_hz / 2; i++) {
+                modulator.next(levels, duties);
+                writes += rgb::play_period(duties, modulator.steps(), deadline, period, on, [](const std::array<bool, 3>&) {});
+                deadline += period;
+            }
+            rgb::sleep_until(deadline);
+            auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            auto cpu = thread_cpu_seconds() - cpu_start;
+            std::cout << std::setw(6) << bits << std::setw(8) << (dither? "on" : "off") << std::setw(12) << outputs.size()
+                << std::setw(12) << std::fixed << std::setprecision(1) << max_error
+                << std::setw(12) << std::setprecision(0) << writes / elapsed
+                << std::setw(10) << std::setprecision(3) << cpu / elapsed * 100 << std::endl;
+        }
+    }
+    return 0;
+}
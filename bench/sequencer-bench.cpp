@@ -0,0 +1,64 @@
+/**
+ * Benchmark of the coroutine sequencing runtime: thousands of concurrent blink sequences on one thread
+ * SPDX-License-Identifier: MIT
+ */
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+
+#include "../sequencer.hpp"
+
+static std::vector<uint8_t> leds;
+
+sequencer::Task blink(size_t index, std::chrono::milliseconds half_period, sequencer::clock::time_point start)
+{
+    auto t = start;
+    for (;;) {
+        leds[index] ^= 1;
+        t += half_period;
+        co_await sequencer::sleep_until(t);
+    }
+}
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    const auto duration = std::chrono::seconds(argc > 1? std::stoi(argv[1]) : 2);
+    std::cout << std::setw(10) << "sequences" << std::setw(12) << "steps/s" << std::setw(12) << "wakeups/s"
+        << std::setw(12) << "ns/step" << std::setw(10) << "cpu %" << std::setw(14) << "frame allocs" << std::endl;
+    for (size_t n : {1000, 4000, 16000}) {
+        sequencer::Scheduler scheduler(n);
+        leds.assign(n, 0);
+        auto start = sequencer::clock::now();
+        // blink rates between 1Hz and 10Hz with staggered phases
+        for (size_t i = 0; i < n; i++) {
+            scheduler.spawn(blink(i, std::chrono::milliseconds(50 + i % 451), start + std::chrono::microseconds(i * 997 % 100000)), start);
+        }
+        scheduler.run_due(start);
+        auto allocations_before = sequencer::FramePool::instance().get_allocations();
+        auto resumes_before = scheduler.get_resumes();
+        uint64_t wakeups = 0;
+        auto cpu_before = cpu_seconds();
+        auto begin = sequencer::clock::now();
+        while (sequencer::clock::now() - begin < duration) {
+            std::this_thread::sleep_until(scheduler.next_deadline());
+            // edges within 1ms of each other are applied together, as the service loop would
+            scheduler.run_due(sequencer::clock::now() + std::chrono::milliseconds(1));
+            wakeups++;
+        }
+        auto wall = std::chrono::duration<double>(sequencer::clock::now() - begin).count();
+        auto cpu = cpu_seconds() - cpu_before;
+        auto steps = scheduler.get_resumes() - resumes_before;
+        std::cout << std::setw(10) << n << std::setw(12) << (uint64_t)(steps / wall) << std::setw(12) << (uint64_t)(wakeups / wall)
+            << std::setw(12) << (uint64_t)(cpu * 1e9 / std::max<uint64_t>(steps, 1)) << std::setw(10) << std::fixed << std::setprecision(2) << cpu / wall * 100
+            << std::setw(14) << sequencer::FramePool::instance().get_allocations() - allocations_before << std::endl;
+    }
+    return 0;
+}
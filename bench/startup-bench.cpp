@@ -0,0 +1,79 @@
+/**
+ * Benchmark of client start-up: binary size, peak RSS and exec-to-exit time of a command run by each
+ * of the given binaries, e.g. the D-Bus and the D-Bus-less build of led-indicator:
+ *   bench/startup-bench ./led-indicator ./led-indicator-nodbus -- --varlink get
+ * SPDX-License-Identifier: MIT
+ */
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+
+extern char** environ;
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> binaries, args;
+    int i = 1;
+    for (; i < argc && std::strcmp(argv[i], "--") != 0; i++) binaries.push_back(argv[i]);
+    for (i++; i < argc; i++) args.push_back(argv[i]);
+    if (binaries.empty()) {
+        std::cerr << "Usage: " << argv[0] << " BINARY... [-- ARGS...]" << std::endl;
+        return 1;
+    }
+    //else
+
+    const int runs = 100;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::cout << std::setw(28) << "binary" << std::setw(12) << "size KiB" << std::setw(12) << "RSS KiB"
+        << std::setw(12) << "ms (p50)" << std::setw(12) << "ms (p90)" << std::setw(8) << "exit" << std::endl;
+    for (const auto& binary : binaries) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(binary, ec);
+        std::vector<char*> child_argv{(char*)binary.c_str()};
+        for (const auto& arg : args) child_argv.push_back((char*)arg.c_str());
+        child_argv.push_back(nullptr);
+
+        std::vector<double> ms;
+        std::vector<long> rss_kib;
+        int status = 0;
+        for (int run = 0; run < runs; run++) {
+            auto start = std::chrono::steady_clock::now();
+            pid_t pid;
+            if (posix_spawn(&pid, binary.c_str(), &actions, nullptr, child_argv.data(), environ) != 0) break;
+            //else
+            struct rusage usage;
+            if (wait4(pid, &status, 0, &usage) < 0) break;
+            //else
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            rss_kib.push_back(usage.ru_maxrss);
+        }
+        std::cout << std::setw(28) << binary;
+        if (ms.empty()) {
+            std::cout << "  cannot run" << std::endl;
+            continue;
+        }
+        //else
+        std::sort(ms.begin(), ms.end());
+        std::sort(rss_kib.begin(), rss_kib.end());
+        std::cout << std::setw(12) << (ec? 0 : size / 1024) << std::setw(12) << rss_kib[rss_kib.size() / 2] << std::fixed << std::setprecision(2)
+            << std::setw(12) << ms[ms.size() / 2] << std::setw(12) << ms[ms.size() * 9 / 10]
+            << std::setw(8) << (WIFEXITED(status)? WEXITSTATUS(status) : -1) << std::endl;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * Benchmark of fixed-tick evaluation against the sparse next-change timeline
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+
+#include "../frame.hpp"
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    const uint64_t simulated_ms = 60000, tick_ms = 1;
+    std::cout << "simulating " << simulated_ms / 1000 << "s; the fixed tick evaluates all LEDs every " << tick_ms << "ms" << std::endl;
+    std::cout << std::setw(6) << "LEDs" << std::setw(12) << "edges/s" << std::setw(14) << "tick wake/s" << std::setw(14) << "tick us/s"
+        << std::setw(14) << "sparse wake/s" << std::setw(14) << "sparse us/s" << std::endl;
+    for (size_t n : {8, 64, 512, 4096}) {
+        frame::Evaluator evaluator;
+        frame::Timeline timeline;
+        for (size_t i = 0; i < n; i++) {
+            auto pattern = i % 4 == 0? frame::Pattern::on() : frame::Pattern::blink(250 + 50 * (i % 16), i * 37 % 1000);
+            evaluator.add(pattern);
+            timeline.add(pattern, 0);
+        }
+
+        // fixed tick: every LED every tick, write whenever the frame differs
+        std::vector<uint64_t> frame_bits(evaluator.words()), previous(evaluator.words());
+        uint64_t tick_writes = 0;
+        auto start = clock::now();
+        for (uint64_t t = 0; t < simulated_ms; t += tick_ms) {
+            evaluator.evaluate(t, frame_bits.data());
+            if (std::memcmp(frame_bits.data(), previous.data(), frame_bits.size() * 8) != 0) {
+                tick_writes++;
+                previous.swap(frame_bits);
+            }
+        }
+        auto tick_us = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+        // timeline: wake only at the earliest pending edge, apply all edges within 1ms together
+        start = clock::now();
+        for (uint64_t t = timeline.next_deadline(); t < simulated_ms; t = timeline.next_deadline()) {
+            timeline.advance(t, 1);
+        }
+        auto sparse_us = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+
+        const double seconds = simulated_ms / 1000.0;
+        std::cout << std::setw(6) << n << std::setw(12) << (uint64_t)(timeline.get_edges() / seconds)
+            << std::setw(14) << (uint64_t)(simulated_ms / tick_ms / seconds) << std::setw(14) << std::fixed << std::setprecision(1) << tick_us / seconds
+            << std::setw(14) << (uint64_t)(timeline.get_wakeups() / seconds) << std::setw(14) << sparse_us / seconds << std::endl;
+        (void)tick_writes;
+    }
+    return 0;
+}
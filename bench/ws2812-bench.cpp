@@ -0,0 +1,48 @@
+/**
+ * Benchmark of WS2812 SPI bitstream encoding
+ * SPDX-License-Identifier: MIT
+ */
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+
+#include "../ws2812.hpp"
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    std::cout << std::setw(8) << "pixels" << std::setw(14) << "table us" << std::setw(14) << "encode us" << std::setw(14) << "MB/s in" << std::endl;
+    uint64_t sink = 0;
+    for (size_t pixels : {100, 300, 1000, 5000}) {
+        std::vector<uint8_t> grb(pixels * 3);
+        for (size_t i = 0; i < grb.size(); i++) grb[i] = (i * 151 + 7) & 0xff;
+        std::vector<uint8_t> expected(ws2812::encoded_size(grb.size())), out(expected.size());
+        ws2812::encode_scalar(grb.data(), grb.size(), expected.data());
+        std::fill(expected.end() - ws2812::reset_bytes, expected.end(), 0);
+        ws2812::encode(grb.data(), grb.size(), out.data());
+        if (out != expected) {
+            std::cerr << "encoder mismatch at " << pixels << " pixels" << std::endl;
+            return 1;
+        }
+
+        const int iterations = 20000000 / (pixels * 3);
+        auto start = clock::now();
+        for (int n = 0; n < iterations; n++) {
+            grb[0] = n;
+            ws2812::encode_scalar(grb.data(), grb.size(), out.data());
+            sink += out[n % out.size()];
+        }
+        auto table_us = std::chrono::duration<double, std::micro>(clock::now() - start).count() / iterations;
+        start = clock::now();
+        for (int n = 0; n < iterations; n++) {
+            grb[0] = n;
+            ws2812::encode(grb.data(), grb.size(), out.data());
+            sink += out[n % out.size()];
+        }
+        auto encode_us = std::chrono::duration<double, std::micro>(clock::now() - start).count() / iterations;
+        std::cout << std::setw(8) << pixels << std::setw(14) << std::fixed << std::setprecision(2) << table_us << std::setw(14) << encode_us
+            << std::setw(14) << std::setprecision(0) << grb.size() / encode_us << std::endl;
+    }
+    return sink == 42;
+}
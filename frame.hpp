@@ -0,0 +1,255 @@
+/**
+ * LED Indicator - frame evaluation for many LEDs at once
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Computes the state of every LED of a panel for a point in time as a packed bitmask (bit i of word i/64
+// is LED i), ready to be handed to a bulk output write.
+//
+// Each LED's pattern is kept in structure-of-arrays form as a 32-bit phase accumulator:
+//
+//   on = (t_ms * increment + offset) mod 2^32 < duty
+//
+// where increment = 2^32 / period.  Steady on/off are the degenerate cases increment = 0, so evaluation is
+// branch-free, and since t_ms is taken mod 2^32 as well its wraparound is seamless.  Rounding the increment
+// drifts a pattern by less than 0.1ms per 1000s.
+namespace frame {
+
+struct Pattern {
+    uint32_t period_ms = 0;  // 0 means steady
+    uint32_t on_ms = 0;      // steady on when period_ms == 0 and on_ms > 0
+    uint32_t phase_ms = 0;
+
+    static Pattern on() { return {0, 1, 0}; }
+    static Pattern off() { return {0, 0, 0}; }
+    static Pattern blink(uint32_t half_period_ms, uint32_t phase_ms = 0) { return {half_period_ms * 2, half_period_ms, phase_ms}; }
+};
+
+inline bool get_bit(const uint64_t* bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; }
+
+class Evaluator {
+    std::vector<uint32_t> increment, offset, duty;  // padded to a multiple of 64 LEDs with steady off
+    size_t count = 0;
+public:
+    size_t size() const { return count; }
+    size_t words() const { return (count + 63) / 64; }
+
+    size_t add(const Pattern& pattern)
+    {
+        if (count % 64 == 0) {
+            increment.resize(count + 64, 0);
+            offset.resize(count + 64, 0);
+            duty.resize(count + 64, 0);
+        }
+        set(count, pattern);
+        return count++;
+    }
+
+    void set(size_t i, const Pattern& pattern)
+    {
+        if (pattern.period_ms == 0) {
+            increment[i] = 0;
+            offset[i] = 0;
+            duty[i] = pattern.on_ms > 0? UINT32_MAX : 0;
+            return;
+        }
+        //else
+        auto inc = (uint32_t)std::llround(4294967296.0 / pattern.period_ms);
+        increment[i] = inc;
+        offset[i] = pattern.phase_ms * inc;
+        duty[i] = pattern.on_ms >= pattern.period_ms? UINT32_MAX : pattern.on_ms * inc;
+    }
+
+    // out must hold words() elements
+    void evaluate(uint32_t t_ms, uint64_t* out) const
+    {
+        const size_t padded = words() * 64;
+#if defined(__AVX2__)
+        const __m256i t = _mm256_set1_epi32((int)t_ms);
+        const __m256i bias = _mm256_set1_epi32(INT32_MIN);  // unsigned compare via signed compare
+        for (size_t i = 0; i < padded; i += 64) {
+            uint64_t word = 0;
+            for (size_t j = 0; j < 64; j += 8) {
+                auto inc = _mm256_loadu_si256((const __m256i*)&increment[i + j]);
+                auto off = _mm256_loadu_si256((const __m256i*)&offset[i + j]);
+                auto d = _mm256_loadu_si256((const __m256i*)&duty[i + j]);
+                auto acc = _mm256_add_epi32(_mm256_mullo_epi32(t, inc), off);
+                auto lt = _mm256_cmpgt_epi32(_mm256_xor_si256(d, bias), _mm256_xor_si256(acc, bias));
+                word |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(lt)) << j;
+            }
+            out[i / 64] = word;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint32x4_t t = vdupq_n_u32(t_ms);
+        const uint32_t weights_init[4] = {1, 2, 4, 8};
+        const uint32x4_t weights = vld1q_u32(weights_init);
+        for (size_t i = 0; i < padded; i += 64) {
+            uint64_t word = 0;
+            for (size_t j = 0; j < 64; j += 4) {
+                auto acc = vmlaq_u32(vld1q_u32(&offset[i + j]), t, vld1q_u32(&increment[i + j]));
+                auto lt = vcltq_u32(acc, vld1q_u32(&duty[i + j]));
+                word |= (uint64_t)vaddvq_u32(vandq_u32(lt, weights)) << j;
+            }
+            out[i / 64] = word;
+        }
+#else
+        for (size_t i = 0; i < padded; i += 64) {
+            uint64_t word = 0;
+            for (size_t j = 0; j < 64; j++) {
+                word |= (uint64_t)(t_ms * increment[i + j] + offset[i + j] < duty[i + j]) << j;
+            }
+            out[i / 64] = word;
+        }
+#endif
+    }
+};
+
+// Sparse alternative to evaluating every LED on a fixed tick: each LED's next transition time is kept in
+// an indexed min-heap, so the caller sleeps until next_deadline() and advance() touches only the LEDs
+// whose edges are due.  Wakeups then scale with the number of actual edges, not with LEDs x ticks.
+class Timeline {
+    static constexpr uint32_t npos = UINT32_MAX;
+    std::vector<Pattern> patterns;
+    std::vector<uint64_t> next_edge;  // ms
+    std::vector<uint32_t> heap;       // LED indices ordered by next_edge
+    std::vector<uint32_t> position;   // LED index -> heap position or npos
+    std::vector<uint64_t> bits;
+    uint64_t edges = 0, wakeups = 0;
+
+    static bool state_at(const Pattern& pattern, uint64_t t_ms)
+    {
+        if (pattern.period_ms == 0) return pattern.on_ms > 0;
+        //else
+        return (t_ms + pattern.phase_ms) % pattern.period_ms < pattern.on_ms;
+    }
+
+    static bool is_steady(const Pattern& pattern) { return pattern.period_ms == 0 || pattern.on_ms == 0 || pattern.on_ms >= pattern.period_ms; }
+
+    static uint64_t edge_after(const Pattern& pattern, uint64_t t_ms)
+    {
+        auto phase = (t_ms + pattern.phase_ms) % pattern.period_ms;
+        return t_ms + (phase < pattern.on_ms? pattern.on_ms - phase : pattern.period_ms - phase);
+    }
+
+    void swap_nodes(size_t a, size_t b)
+    {
+        std::swap(heap[a], heap[b]);
+        position[heap[a]] = a;
+        position[heap[b]] = b;
+    }
+
+    void sift_up(size_t i)
+    {
+        while (i > 0) {
+            auto parent = (i - 1) / 2;
+            if (next_edge[heap[parent]] <= next_edge[heap[i]]) break;
+            swap_nodes(i, parent);
+            i = parent;
+        }
+    }
+
+    void sift_down(size_t i)
+    {
+        for (;;) {
+            auto smallest = i, left = 2 * i + 1, right = left + 1;
+            if (left < heap.size() && next_edge[heap[left]] < next_edge[heap[smallest]]) smallest = left;
+            if (right < heap.size() && next_edge[heap[right]] < next_edge[heap[smallest]]) smallest = right;
+            if (smallest == i) break;
+            swap_nodes(i, smallest);
+            i = smallest;
+        }
+    }
+
+    void remove(uint32_t led)
+    {
+        auto i = position[led];
+        if (i == npos) return;
+        //else
+        swap_nodes(i, heap.size() - 1);
+        heap.pop_back();
+        position[led] = npos;
+        if (i < heap.size()) {
+            sift_up(i);
+            sift_down(i);
+        }
+    }
+
+    void set_bit(size_t i, bool on)
+    {
+        if (on) bits[i / 64] |= (uint64_t)1 << (i % 64);
+        else bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+public:
+    size_t size() const { return patterns.size(); }
+    const uint64_t* get_bits() const { return bits.data(); }
+    uint64_t get_edges() const { return edges; }
+    uint64_t get_wakeups() const { return wakeups; }
+
+    size_t add(const Pattern& pattern, uint64_t now_ms)
+    {
+        auto i = patterns.size();
+        patterns.push_back(Pattern::off());
+        next_edge.push_back(0);
+        position.push_back(npos);
+        bits.resize((patterns.size() + 63) / 64, 0);
+        set(i, pattern, now_ms);
+        return i;
+    }
+
+    const Pattern& get(size_t i) const { return patterns[i]; }
+
+    // applies the pattern's current state immediately; returns whether the LED's state changed
+    bool set(size_t i, const Pattern& pattern, uint64_t now_ms)
+    {
+        patterns[i] = pattern;
+        bool was_on = (bits[i / 64] >> (i % 64)) & 1;
+        bool on = state_at(pattern, now_ms);
+        set_bit(i, on);
+        if (is_steady(pattern)) {
+            remove(i);
+        } else {
+            next_edge[i] = edge_after(pattern, now_ms);
+            if (position[i] == npos) {
+                heap.push_back(i);
+                position[i] = heap.size() - 1;
+            }
+            sift_up(position[i]);
+            sift_down(position[i]);
+        }
+        return was_on != on;
+    }
+
+    uint64_t next_deadline() const { return heap.empty()? UINT64_MAX : next_edge[heap.front()]; }
+
+    // applies every transition due by now_ms + window_ms at once; returns how many LEDs changed
+    size_t advance(uint64_t now_ms, uint64_t window_ms = 1)
+    {
+        size_t changed = 0;
+        while (!heap.empty() && next_edge[heap.front()] <= now_ms + window_ms) {
+            auto led = heap.front();
+            auto edge = next_edge[led];
+            set_bit(led, state_at(patterns[led], edge));
+            next_edge[led] = edge_after(patterns[led], edge);
+            sift_down(0);
+            changed++;
+        }
+        edges += changed;
+        if (changed > 0) wakeups++;
+        return changed;
+    }
+};
+
+} // namespace frame
@@ -6,146 +6,3456 @@
 
 #include <poll.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include <iostream>
+#include <fstream>
 #include <filesystem>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <chrono>
+#include <memory>
+#include <map>
+#include <functional>
+#include <array>
+#include <optional>
+#include <string_view>
+#include <charconv>
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstring>
+#include <cctype>
+#include <cmath>
 
 #include <gpiod.hpp>
 #include <argparse/argparse.hpp>
+#ifndef NO_DBUS
 #include <sdbus-c++/sdbus-c++.h>
+#endif
+
+#include "sequencer.hpp"
+#include "frame.hpp"
+#include "ws2812.hpp"
+#include "render.hpp"
+#include "rgb.hpp"
+#include "varlink.hpp"
 
 namespace defaults {
     const char* chipname = "gpiochip0";
     const unsigned int line_num = 13;  // GPIO13
 
-    const char* serviceName = "com.walbrix.LedIndicatorService";
-    const char* objectPath = "/com/walbrix/LedIndicator";
-    const char* interfaceName = "com.walbrix.LedIndicator";
+    const char* serviceName = "com.walbrix.LedIndicatorService";
+    const char* objectPath = "/com/walbrix/LedIndicator";
+    const char* interfaceName = "com.walbrix.LedIndicator";
+    const char* varlink_socket = "/run/com.walbrix.LedIndicator";
+
+    const unsigned int flash_on_ms = 40;
+    const unsigned int flash_off_ms = 40;
+    const unsigned int button_debounce_ms = 30;
+    const unsigned int sync_period_ms = 1000;
+    const unsigned int transmit_baud = 10;
+    const unsigned int matrix_refresh_hz = 100;
+    const char* strip_color = "#ffffff";
+    const char* rgb_gamma = "2.2";
+    const unsigned int rgb_pwm_hz = 200;
+    const unsigned int rgb_bits = 8;
+    const char* pwm_root = "/sys/class/pwm";
+    const unsigned int pwm_period_ns = 1000000;
+    const char* leds_root = "/sys/class/leds";
+    const unsigned int max_wait_change_ms = 20000;  // within D-Bus's default method call timeout of 25s
+}
+
+const std::string progname = "led-indicator";
+
+std::string serviceName = defaults::serviceName;
+std::string objectPath = defaults::objectPath;
+std::string interfaceName = defaults::interfaceName;
+#ifndef NO_DBUS
+bool use_dbus = true;
+bool use_varlink = false;
+#else
+// built without sdbus-c++ (make led-indicator-nodbus): Varlink is the only control interface
+bool use_dbus = false;
+bool use_varlink = true;
+#endif
+std::string varlink_socket = defaults::varlink_socket;
+
+std::chrono::milliseconds flash_on_time(defaults::flash_on_ms);
+std::chrono::milliseconds flash_off_time(defaults::flash_off_ms);
+std::string trigger_fifo_path;
+std::vector<unsigned int> panel_line_nums;
+std::vector<unsigned int> shift_register_line_nums;  // data, clock, latch
+unsigned int panel_size = 0;
+unsigned int panel_tick_ms = 0;  // 0: the panel is written at its edges (frame::Timeline)
+std::vector<std::string> panel_names;  // panel LED i is panel_names[i]
+std::vector<unsigned int> matrix_row_line_nums, matrix_col_line_nums;
+unsigned int matrix_refresh_hz = defaults::matrix_refresh_hz;
+std::string strip_device;
+unsigned int strip_length = 0;
+std::string strip_color = defaults::strip_color;
+unsigned int strip_fps = 0;
+unsigned int strip_threads = std::max(std::thread::hardware_concurrency(), 1U);
+unsigned int strip_main_pixel = 0;  // where the main LED is shown when the strip is its only backend
+std::vector<std::string> button_specs;  // LINE[:ACTION]
+std::chrono::milliseconds button_debounce_time(defaults::button_debounce_ms);
+std::optional<unsigned int> sync_line_num;
+std::chrono::milliseconds sync_period(defaults::sync_period_ms);
+unsigned int transmit_baud = defaults::transmit_baud;
+std::vector<unsigned int> rgb_line_nums;  // red, green, blue
+bool rgb_common_cathode = false;
+std::string rgb_gamma = defaults::rgb_gamma;
+unsigned int rgb_pwm_hz = defaults::rgb_pwm_hz;
+unsigned int rgb_bits = defaults::rgb_bits;
+bool rgb_dither = true;
+std::optional<std::pair<unsigned int, unsigned int>> pwm_channel;  // pwmchip, channel
+std::string pwm_root = defaults::pwm_root;
+std::string led_class_name;
+std::string leds_root = defaults::leds_root;
+
+enum led_action_t { LED_ON, LED_OFF, LED_BLINK, LED_DYNAMIC };
+
+led_action_t led_action = LED_OFF;
+
+// colours of the on and off states of the main LED when it is an RGB LED
+struct LedColors {
+    rgb::Color on = {255, 255, 255}, off = {0, 0, 0};
+    bool operator==(const LedColors&) const = default;
+};
+LedColors led_colors;
+unsigned int led_brightness = 100;  // percent, with a kernel PWM channel
+
+#define PERROR(s) throw std::runtime_error(std::string(s) + ": " + std::strerror(errno))
+
+// zero-allocation helpers for parsing /proc text files
+std::string_view next_token(std::string_view& s)
+{
+    auto start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        s = {};
+        return {};
+    }
+    //else
+    s.remove_prefix(start);
+    auto end = std::min(s.find_first_of(" \t"), s.size());
+    auto token = s.substr(0, end);
+    s.remove_prefix(end);
+    return token;
+}
+
+std::string_view next_line(std::string_view& s)
+{
+    auto end = s.find('\n');
+    auto line = s.substr(0, end);
+    s.remove_prefix(end == std::string_view::npos? s.size() : end + 1);
+    return line;
+}
+
+uint64_t to_u64(std::string_view s)
+{
+    uint64_t value = 0;
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return value;
+}
+
+double to_double(std::string_view s)
+{
+    double value = 0.0;
+    std::from_chars(s.data(), s.data() + s.size(), value);
+    return value;
+}
+
+// A persistently opened /proc file re-read from offset 0 with pread() into a buffer allocated once
+class ProcFile {
+    std::string path;
+    int fd;
+    std::vector<char> buf;
+public:
+    ProcFile(const std::string& _path, size_t bufsize = 4096) : path(_path), buf(bufsize)
+    {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) PERROR("open(" + path + ")");
+    }
+    ProcFile(const ProcFile&) = delete;
+    ~ProcFile() { close(fd); }
+
+    std::string_view read_all()
+    {
+        size_t len = 0;
+        while (len < buf.size()) {
+            auto n = pread(fd, buf.data() + len, buf.size() - len, len);
+            if (n < 0) PERROR("pread(" + path + ")");
+            if (n == 0) break;
+            len += n;
+        }
+        return std::string_view(buf.data(), len);
+    }
+};
+
+// An LED action whose state changes over time on its own.  The service loop calls update() when
+// next_deadline() has passed, and hands it events of the file descriptors it added to the poll set.
+class DynamicAction {
+    std::string action;
+public:
+    DynamicAction(const std::string& _action) : action(_action) {}
+    virtual ~DynamicAction() = default;
+    const std::string& get_action() const { return action; }
+    virtual bool get_led_state() const = 0;
+    virtual void update(std::chrono::steady_clock::time_point now) = 0;
+    virtual std::chrono::steady_clock::time_point next_deadline() const = 0;
+    virtual void add_poll_fds(std::vector<pollfd>& /*fds*/) const {}
+    virtual void handle_poll_event(const pollfd& /*fd*/) {}
+    virtual void get_stats(std::map<std::string, std::string>& /*stats*/) const {}
+    // estimated service loop wakeups per second the action costs while it is timed in userspace
+    virtual double get_wakeups_per_second() const { return 0.0; }
+};
+
+// Turns triggers into flashes lasting flash_on_time with at least flash_off_time between them.  Triggers
+// arriving during a flash or its off gap are coalesced into one further flash, which bounds GPIO writes
+// per second no matter how bursty the trigger source is.
+class Flasher {
+    bool pending = false, led = false;
+    std::chrono::steady_clock::time_point flash_until;
+    uint64_t flashes = 0;
+public:
+    bool get_led_state() const { return led; }
+    uint64_t get_flashes() const { return flashes; }
+
+    void trigger() { pending = true; }
+
+    void update(std::chrono::steady_clock::time_point now)
+    {
+        if (led && now >= flash_until) led = false;
+        if (pending && !led && now >= flash_until + flash_off_time) {
+            led = true;
+            pending = false;
+            flash_until = now + flash_on_time;
+            flashes++;
+        }
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const
+    {
+        if (led) return flash_until;
+        if (pending) return flash_until + flash_off_time;
+        //else
+        return std::chrono::steady_clock::time_point::max();
+    }
+};
+
+// A monotonically increasing I/O counter read from a /proc file
+class ActivitySource {
+protected:
+    ProcFile file;
+public:
+    ActivitySource(const char* path) : file(path, 65536) {}
+    virtual ~ActivitySource() = default;
+    virtual uint64_t read_counter() = 0;
+};
+
+class DiskActivitySource : public ActivitySource {
+    std::string device;  // empty means all block devices
+public:
+    DiskActivitySource(const std::string& _device) : ActivitySource("/proc/diskstats"), device(_device)
+    {
+        if (!device.empty() && !find_device()) throw std::runtime_error("No such block device: " + device);
+    }
+
+    bool find_device()
+    {
+        auto content = file.read_all();
+        while (!content.empty()) {
+            auto line = next_line(content);
+            next_token(line); next_token(line);  // major, minor
+            if (next_token(line) == device) return true;
+        }
+        return false;
+    }
+
+    uint64_t read_counter() override
+    {
+        auto content = file.read_all();
+        uint64_t counter = 0;
+        while (!content.empty()) {
+            auto line = next_line(content);
+            next_token(line); next_token(line);  // major, minor
+            auto name = next_token(line);
+            if (!device.empty() && name != device) continue;
+            // fields: reads completed, reads merged, sectors read, ms reading, writes completed, ...
+            counter += to_u64(next_token(line));
+            for (int i = 0; i < 3; i++) next_token(line);
+            counter += to_u64(next_token(line));
+        }
+        return counter;
+    }
+};
+
+class NetActivitySource : public ActivitySource {
+    std::vector<std::string> interfaces;  // empty means all but loopback
+
+    bool is_watched(std::string_view name) const
+    {
+        if (interfaces.empty()) return name != "lo";
+        //else
+        return std::find(interfaces.begin(), interfaces.end(), name) != interfaces.end();
+    }
+public:
+    NetActivitySource(const std::string& _interfaces) : ActivitySource("/proc/net/dev")
+    {
+        std::string_view rest = _interfaces;
+        while (!rest.empty()) {
+            auto comma = std::min(rest.find(','), rest.size());
+            if (comma > 0) interfaces.emplace_back(rest.substr(0, comma));
+            rest.remove_prefix(std::min(comma + 1, rest.size()));
+        }
+        for (const auto& interface : interfaces) {
+            if (!std::filesystem::exists("/sys/class/net/" + interface)) throw std::runtime_error("No such network interface: " + interface);
+        }
+    }
+
+    uint64_t read_counter() override
+    {
+        auto content = file.read_all();
+        next_line(content); next_line(content);  // headers
+        uint64_t counter = 0;
+        while (!content.empty()) {
+            auto line = next_line(content);
+            auto colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            auto name = line.substr(0, colon);
+            name.remove_prefix(std::min(name.find_first_not_of(' '), name.size()));
+            if (!is_watched(name)) continue;
+            line.remove_prefix(colon + 1);
+            // fields: rx bytes, packets, errs, drop, fifo, frame, compressed, multicast, tx bytes, ...
+            counter += to_u64(next_token(line));
+            for (int i = 0; i < 7; i++) next_token(line);
+            counter += to_u64(next_token(line));
+        }
+        return counter;
+    }
+};
+
+// Flickers the LED on counter changes.  Sampling slows down exponentially while the counter is idle and
+// each flash lasts at least flash_on_time so that bursts of I/O stay visible.
+class ActivityMonitor : public DynamicAction {
+    static constexpr std::chrono::milliseconds min_interval{20}, max_interval{640};
+    std::unique_ptr<ActivitySource> source;
+    uint64_t last_counter;
+    std::chrono::milliseconds interval = min_interval;
+    std::chrono::steady_clock::time_point started, next_sample;
+    Flasher flasher;
+    uint64_t samples = 0;
+    std::chrono::nanoseconds sampling_time{0};
+public:
+    ActivityMonitor(std::unique_ptr<ActivitySource>&& _source, const std::string& _action)
+        : DynamicAction(_action), source(std::move(_source))
+    {
+        last_counter = source->read_counter();
+        started = std::chrono::steady_clock::now();
+        next_sample = started + interval;
+    }
+
+    bool get_led_state() const override { return flasher.get_led_state(); }
+
+    void update(std::chrono::steady_clock::time_point now) override
+    {
+        if (now >= next_sample) {
+            auto counter = source->read_counter();
+            samples++;
+            sampling_time += std::chrono::steady_clock::now() - now;
+            if (counter != last_counter) {
+                flasher.trigger();
+                interval = min_interval;
+            } else {
+                interval = std::min(interval * 2, max_interval);
+            }
+            last_counter = counter;
+            next_sample = now + interval;
+        }
+        flasher.update(now);
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        stats["activity.samples"] = std::to_string(samples);
+        stats["activity.flashes"] = std::to_string(flasher.get_flashes());
+        stats["activity.interval_ms"] = std::to_string(interval.count());
+        stats["activity.sample_ns_avg"] = std::to_string(samples? sampling_time.count() / samples : 0);
+        stats["activity.cpu_percent"] = std::to_string(100.0 * sampling_time.count() / std::max(elapsed.count(), (decltype(elapsed.count()))1));
+    }
+
+    double get_wakeups_per_second() const override { return 1000.0 / interval.count(); }
+
+    std::chrono::steady_clock::time_point next_deadline() const override
+    {
+        return std::min(next_sample, flasher.next_deadline());
+    }
+};
+
+// Flashes the LED when a watched file or directory changes
+class WatchTrigger : public DynamicAction {
+    int fd;
+    Flasher flasher;
+    uint64_t events = 0;
+public:
+    WatchTrigger(const std::string& action, const std::string& path) : DynamicAction(action)
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) PERROR("inotify_init1");
+        if (inotify_add_watch(fd, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            close(fd);
+            PERROR("inotify_add_watch(" + path + ")");
+        }
+    }
+    ~WatchTrigger() { close(fd); }
+
+    bool get_led_state() const override { return flasher.get_led_state(); }
+    void update(std::chrono::steady_clock::time_point now) override { flasher.update(now); }
+    std::chrono::steady_clock::time_point next_deadline() const override { return flasher.next_deadline(); }
+
+    void add_poll_fds(std::vector<pollfd>& fds) const override
+    {
+        fds.push_back({fd, POLLIN, 0});
+    }
+
+    void handle_poll_event(const pollfd& /*pfd*/) override
+    {
+        // drain everything queued so far; the whole batch counts as a single trigger
+        alignas(inotify_event) char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            for (ssize_t pos = 0; pos < n; pos += sizeof(inotify_event) + ((const inotify_event*)(buf + pos))->len) {
+                events++;
+            }
+        }
+        if (n < 0 && errno != EAGAIN) PERROR("read(inotify)");
+        flasher.trigger();
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["watch.events"] = std::to_string(events);
+        stats["watch.flashes"] = std::to_string(flasher.get_flashes());
+        stats["watch.coalesced"] = std::to_string(events - std::min(events, flasher.get_flashes()));
+    }
+};
+
+// Double-pulse heartbeat whose period shortens with system load.  CPU pressure (PSI) is preferred over
+// /proc/loadavg.  PSI trigger fds wake the loop as soon as pressure crosses one of the thresholds, while
+// falling load is picked up by re-sampling at the start of a heartbeat cycle, so no extra timer is needed.
+class LoadHeartbeat : public DynamicAction {
+    static constexpr std::chrono::milliseconds min_period{300}, max_period{1500}, pulse_time{70};
+    static constexpr std::chrono::seconds sample_interval{2};
+    static constexpr int trigger_window_us = 2000000;
+    static constexpr int trigger_thresholds_percent[] = {10, 30, 60};
+    bool psi;
+    std::unique_ptr<ProcFile> source;
+    std::vector<int> trigger_fds;
+    double load = 0.0;
+    std::chrono::milliseconds period = max_period;
+    std::chrono::steady_clock::time_point cycle_start, last_sample;
+    bool led = false;
+    uint64_t samples = 0, psi_events = 0;
+
+    void sample(std::chrono::steady_clock::time_point now)
+    {
+        auto content = source->read_all();
+        if (psi) {
+            // some avg10=0.12 avg60=0.05 avg300=0.01 total=12345
+            auto line = next_line(content);
+            next_token(line);
+            auto avg10 = next_token(line);
+            if (avg10.starts_with("avg10=")) load = to_double(avg10.substr(6)) / 100.0;
+        } else {
+            load = to_double(next_token(content)) / std::max(std::thread::hardware_concurrency(), 1U);
+        }
+        load = std::clamp(load, 0.0, 1.0);
+        last_sample = now;
+        samples++;
+    }
+
+    void start_cycle(std::chrono::steady_clock::time_point now)
+    {
+        if (now - last_sample >= sample_interval) sample(now);
+        period = std::chrono::duration_cast<std::chrono::milliseconds>(max_period - (max_period - min_period) * load);
+    }
+public:
+    LoadHeartbeat(const std::string& action) : DynamicAction(action)
+    {
+        psi = std::filesystem::exists("/proc/pressure/cpu");
+        source = std::make_unique<ProcFile>(psi? "/proc/pressure/cpu" : "/proc/loadavg");
+        if (psi) {
+            for (auto threshold : trigger_thresholds_percent) {
+                int fd = open("/proc/pressure/cpu", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+                if (fd < 0) break;
+                auto trigger = "some " + std::to_string(trigger_window_us / 100 * threshold) + " " + std::to_string(trigger_window_us);
+                if (write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+                    // triggers need CONFIG_PSI and sufficient privileges; cycle-start sampling still works
+                    close(fd);
+                    break;
+                }
+                trigger_fds.push_back(fd);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        sample(now);
+        start_cycle(now);
+        cycle_start = now;
+        led = true;
+    }
+    ~LoadHeartbeat() { for (auto fd : trigger_fds) close(fd); }
+
+    bool get_led_state() const override { return led; }
+
+    void update(std::chrono::steady_clock::time_point now) override
+    {
+        if (now >= cycle_start + period) {
+            cycle_start = (now < cycle_start + 2 * period)? cycle_start + period : now;
+            start_cycle(now);
+        }
+        auto phase = now - cycle_start;
+        led = phase < pulse_time || (phase >= period / 4 && phase < period / 4 + pulse_time);
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const override
+    {
+        for (auto edge : {pulse_time, period / 4, period / 4 + pulse_time}) {
+            if (cycle_start + edge > std::chrono::steady_clock::now()) return cycle_start + edge;
+        }
+        return cycle_start + period;
+    }
+
+    void add_poll_fds(std::vector<pollfd>& fds) const override
+    {
+        for (auto fd : trigger_fds) fds.push_back({fd, POLLPRI, 0});
+    }
+
+    void handle_poll_event(const pollfd& fd) override
+    {
+        if (fd.revents & (POLLERR | POLLNVAL)) {
+            // the monitored cgroup/pressure file went away
+            close(fd.fd);
+            std::erase(trigger_fds, fd.fd);
+            return;
+        }
+        //else
+        psi_events++;
+        sample(std::chrono::steady_clock::now());
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["heartbeat.source"] = psi? (trigger_fds.empty()? "psi" : "psi+triggers") : "loadavg";
+        stats["heartbeat.load"] = std::to_string(load);
+        stats["heartbeat.period_ms"] = std::to_string(period.count());
+        stats["heartbeat.samples"] = std::to_string(samples);
+        stats["heartbeat.psi_events"] = std::to_string(psi_events);
+    }
+
+    // four edges per beat
+    double get_wakeups_per_second() const override { return 4000.0 / period.count(); }
+};
+
+// Blinks out a payload as Manchester-encoded serial (IEEE 802.3 convention: 0 = high->low, 1 = low->high)
+// framed as preamble 0x55 0x55, sync 0x7e, length, payload, CRC-16/CCITT, followed by an idle gap, repeated
+// forever.  The edge schedule is computed once; playback runs against absolute deadlines and records how
+// far each edge lands from its schedule.
+class Transmitter : public DynamicAction {
+    static constexpr int idle_bits = 16;
+    struct Edge {
+        std::chrono::nanoseconds offset;
+        bool level;
+    };
+    std::vector<Edge> edges;
+    std::chrono::nanoseconds frame_length, half_bit;
+    std::chrono::steady_clock::time_point frame_start, last_edge_time;
+    size_t next_edge = 0;
+    bool led = false;
+    uint64_t frames = 0, edges_sent = 0, resyncs = 0;
+    std::chrono::nanoseconds max_lateness{0}, total_lateness{0};
+    double interval_error_sq_sum = 0.0;  // squared deviation of achieved edge intervals, in us^2
+    uint64_t intervals = 0;
+
+    static uint16_t crc16_ccitt(const std::vector<uint8_t>& data)
+    {
+        uint16_t crc = 0xffff;
+        for (auto byte : data) {
+            crc ^= byte << 8;
+            for (int i = 0; i < 8; i++) crc = (crc & 0x8000)? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        return crc;
+    }
+public:
+    Transmitter(const std::string& action, const std::string& payload, unsigned int baud) : DynamicAction(action)
+    {
+        if (payload.empty() || payload.size() > 255) throw std::runtime_error("Payload must be 1 to 255 bytes");
+        if (baud == 0) throw std::runtime_error("Baud rate must be positive");
+        //else
+        std::vector<uint8_t> body = {(uint8_t)payload.size()};
+        body.insert(body.end(), payload.begin(), payload.end());
+        auto crc = crc16_ccitt(body);
+        body.push_back(crc >> 8);
+        body.push_back(crc & 0xff);
+        std::vector<uint8_t> frame = {0x55, 0x55, 0x7e};
+        frame.insert(frame.end(), body.begin(), body.end());
+
+        half_bit = std::chrono::nanoseconds(std::chrono::seconds(1)) / (2 * baud);
+        bool level = false;  // idle low
+        std::chrono::nanoseconds offset{0};
+        auto emit = [&](bool new_level) {
+            if (new_level != level) edges.push_back({offset, new_level});
+            level = new_level;
+            offset += half_bit;
+        };
+        for (auto byte : frame) {
+            for (int i = 7; i >= 0; i--) {
+                bool bit = (byte >> i) & 1;
+                emit(!bit);
+                emit(bit);
+            }
+        }
+        emit(false);
+        frame_length = offset + (idle_bits * 2 - 1) * half_bit;
+        frame_start = std::chrono::steady_clock::now();
+    }
+
+    bool get_led_state() const override { return led; }
+
+    void update(std::chrono::steady_clock::time_point now) override
+    {
+        while (now >= frame_start + edges[next_edge].offset) {
+            auto scheduled = frame_start + edges[next_edge].offset;
+            auto lateness = now - scheduled;
+            max_lateness = std::max(max_lateness, lateness);
+            total_lateness += lateness;
+            if (edges_sent > 0 && next_edge > 0) {
+                auto nominal = edges[next_edge].offset - edges[next_edge - 1].offset;
+                double error_us = std::chrono::duration<double, std::micro>((now - last_edge_time) - nominal).count();
+                interval_error_sq_sum += error_us * error_us;
+                intervals++;
+            }
+            last_edge_time = now;
+            led = edges[next_edge].level;
+            edges_sent++;
+            if (++next_edge == edges.size()) {
+                next_edge = 0;
+                frames++;
+                // keep the schedule absolute; if we fell behind by more than a frame, restart from now
+                frame_start += frame_length;
+                if (now - frame_start > frame_length) {
+                    frame_start = now;
+                    resyncs++;
+                }
+            }
+        }
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const override
+    {
+        return frame_start + edges[next_edge].offset;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["transmit.frames"] = std::to_string(frames);
+        stats["transmit.edges"] = std::to_string(edges_sent);
+        stats["transmit.resyncs"] = std::to_string(resyncs);
+        stats["transmit.bit_period_us"] = std::to_string(std::chrono::duration<double, std::micro>(half_bit * 2).count());
+        stats["transmit.lateness_us_avg"] = std::to_string(edges_sent? std::chrono::duration<double, std::micro>(total_lateness).count() / edges_sent : 0.0);
+        stats["transmit.lateness_us_max"] = std::to_string(std::chrono::duration<double, std::micro>(max_lateness).count());
+        stats["transmit.jitter_us_rms"] = std::to_string(intervals? std::sqrt(interval_error_sq_sum / intervals) : 0.0);
+    }
+
+    double get_wakeups_per_second() const override { return edges.size() / std::chrono::duration<double>(frame_length).count(); }
+};
+
+// A tiny sandboxed LED program, compiled once from text like:
+//
+//   loop 5
+//     loop 3
+//       set on
+//       wait 100
+//       set off
+//       wait 100
+//     end
+//     wait 1000
+//   end
+//   set on
+//
+// Instructions: set on|off|toggle, wait MS, random MIN MAX (wait a random time), loop N ... end,
+// LABEL:, jump LABEL, halt.  Waits shorter than 1ms are rounded up so that a program can never spin.
+// step() never allocates; it runs until the next wait and returns its deadline.  A step that executes
+// more than max_instructions_per_step instructions or max_step_time of wall time aborts the program.
+class LedProgram : public DynamicAction {
+    enum opcode_t : uint8_t { OP_SET, OP_TOGGLE, OP_WAIT, OP_RANDOM, OP_LOOP, OP_END, OP_JUMP, OP_HALT };
+    struct Instruction {
+        opcode_t op;
+        uint32_t a = 0, b = 0;  // operands; OP_LOOP: a=count, b=its end, OP_END: a=its loop, OP_JUMP: a=target
+    };
+    static constexpr int max_loop_depth = 8;
+    static constexpr int max_instructions_per_step = 1024;
+    static constexpr std::chrono::microseconds max_step_time{500};
+    static constexpr uint32_t min_wait_ms = 1;
+
+    std::vector<Instruction> code;
+    size_t pc = 0;
+    uint32_t loop_counters[max_loop_depth];
+    int loop_depth = 0;
+    uint64_t rng_state;
+    bool led = false, halted = false;
+    const char* status = "running";  // string literals only: step() must not allocate
+    std::chrono::steady_clock::time_point wake_at;
+    uint64_t instructions = 0, steps = 0;
+    std::chrono::nanoseconds vm_time{0};
+    std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+
+    static uint32_t parse_number(std::string_view token, int line_no)
+    {
+        uint32_t value;
+        auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+        if (ec != std::errc() || ptr != token.data() + token.size()) throw std::runtime_error("line " + std::to_string(line_no) + ": number expected");
+        return value;
+    }
+
+    void compile(std::string_view source)
+    {
+        std::map<std::string, size_t, std::less<>> labels;
+        std::vector<std::pair<size_t, std::string>> fixups;
+        std::vector<size_t> open_loops;
+        int line_no = 0;
+        while (!source.empty()) {
+            auto line = next_line(source);
+            line_no++;
+            line = line.substr(0, line.find('#'));
+            auto mnemonic = next_token(line);
+            if (mnemonic.empty()) continue;
+            //else
+            auto error = [line_no](const std::string& message) { return std::runtime_error("line " + std::to_string(line_no) + ": " + message); };
+            if (mnemonic.ends_with(':')) {
+                if (!open_loops.empty()) throw error("label inside loop");
+                if (!labels.emplace(mnemonic.substr(0, mnemonic.size() - 1), code.size()).second) throw error("duplicate label");
+                continue;
+            }
+            //else
+            Instruction instruction{OP_HALT};
+            if (mnemonic == "set") {
+                auto arg = next_token(line);
+                if (arg == "toggle") instruction.op = OP_TOGGLE;
+                else if (arg == "on" || arg == "off") instruction = {OP_SET, arg == "on"};
+                else throw error("set on|off|toggle expected");
+            } else if (mnemonic == "wait") {
+                instruction = {OP_WAIT, std::max(parse_number(next_token(line), line_no), min_wait_ms)};
+            } else if (mnemonic == "random") {
+                auto min = parse_number(next_token(line), line_no);
+                auto max = parse_number(next_token(line), line_no);
+                if (max < min) throw error("random MIN MAX expected");
+                //else
+                min = std::max(min, min_wait_ms);
+                instruction = {OP_RANDOM, min, std::max(max, min)};
+            } else if (mnemonic == "loop") {
+                if (open_loops.size() >= max_loop_depth) throw error("loops nested too deeply");
+                instruction = {OP_LOOP, parse_number(next_token(line), line_no)};
+                open_loops.push_back(code.size());
+            } else if (mnemonic == "end") {
+                if (open_loops.empty()) throw error("end without loop");
+                instruction = {OP_END, (uint32_t)open_loops.back()};
+                code[open_loops.back()].b = code.size();
+                open_loops.pop_back();
+            } else if (mnemonic == "jump") {
+                auto label = next_token(line);
+                if (label.empty()) throw error("label expected");
+                if (!open_loops.empty()) throw error("jump inside loop");
+                fixups.emplace_back(code.size(), std::string(label));
+                instruction.op = OP_JUMP;
+            } else if (mnemonic != "halt") {
+                throw error("unknown instruction " + std::string(mnemonic));
+            }
+            if (!next_token(line).empty()) throw error("extra operand");
+            code.push_back(instruction);
+        }
+        if (!open_loops.empty()) throw std::runtime_error("loop without end");
+        for (const auto& [index, label] : fixups) {
+            auto i = labels.find(label);
+            if (i == labels.end()) throw std::runtime_error("undefined label " + label);
+            code[index].a = i->second;
+        }
+        code.push_back({OP_HALT});
+    }
+
+    uint32_t next_random()
+    {
+        // xorshift64
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        return (uint32_t)rng_state;
+    }
+
+    void abort(const char* reason)
+    {
+        halted = true;
+        led = false;
+        status = reason;
+    }
+
+    // runs until the next wait; returns false when the program has ended
+    bool step(std::chrono::steady_clock::time_point now)
+    {
+        steps++;
+        for (int count = 0; ; count++) {
+            if (count >= max_instructions_per_step) {
+                abort("aborted: instruction limit");
+                return false;
+            }
+            if (count % 64 == 63 && std::chrono::steady_clock::now() - now > max_step_time) {
+                abort("aborted: time limit");
+                return false;
+            }
+            instructions++;
+            auto& instruction = code[pc++];
+            switch (instruction.op) {
+            case OP_SET: led = instruction.a; break;
+            case OP_TOGGLE: led = !led; break;
+            case OP_WAIT:
+                wake_at += std::chrono::milliseconds(instruction.a);
+                return true;
+            case OP_RANDOM:
+                wake_at += std::chrono::milliseconds(instruction.a + next_random() % (instruction.b - instruction.a + 1));
+                return true;
+            case OP_LOOP:
+                if (instruction.a == 0) pc = instruction.b + 1;  // skip past the matching end
+                else loop_counters[loop_depth++] = instruction.a;
+                break;
+            case OP_END:
+                if (--loop_counters[loop_depth - 1] > 0) pc = instruction.a + 1;
+                else loop_depth--;
+                break;
+            case OP_JUMP: pc = instruction.a; break;
+            case OP_HALT:
+                halted = true;
+                status = "halted";
+                return false;
+            }
+        }
+    }
+public:
+    LedProgram(const std::string& source) : DynamicAction("program")
+    {
+        compile(source);
+        rng_state = std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+        wake_at = std::chrono::steady_clock::now();
+        update(wake_at);
+    }
+
+    bool get_led_state() const override { return led; }
+
+    void update(std::chrono::steady_clock::time_point now) override
+    {
+        auto started = std::chrono::steady_clock::now();
+        while (!halted && now >= wake_at) {
+            // after falling far behind, resynchronize rather than replaying every missed step
+            if (now - wake_at > std::chrono::seconds(1)) wake_at = now;
+            step(now);
+        }
+        vm_time += std::chrono::steady_clock::now() - started;
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const override
+    {
+        return halted? std::chrono::steady_clock::time_point::max() : wake_at;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["program.status"] = status;
+        stats["program.size"] = std::to_string(code.size());
+        stats["program.pc"] = std::to_string(pc);
+        stats["program.steps"] = std::to_string(steps);
+        stats["program.instructions"] = std::to_string(instructions);
+        stats["program.vm_time_us"] = std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(vm_time).count());
+    }
+
+    // a program's timing is data dependent, so this is the rate observed so far
+    double get_wakeups_per_second() const override
+    {
+        if (halted) return 0.0;
+        //else
+        return steps / std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - loaded).count(), 1.0);
+    }
+};
+
+#ifndef NO_DBUS
+// the service's own bus connection, shared by actions that talk to other services
+sdbus::IConnection* bus_connection = nullptr;
+
+// Mirrors a systemd unit: on when active, blinking while (de)activating, fast blinking when failed.
+// State changes arrive as PropertiesChanged signals matched on the unit's object path only.
+class UnitFollower : public DynamicAction {
+    static constexpr const char* systemd = "org.freedesktop.systemd1";
+    static constexpr std::chrono::milliseconds blink_interval{500}, fast_blink_interval{125};
+    std::string unit;
+    std::unique_ptr<sdbus::IProxy> manager, proxy;
+    std::string active_state, sub_state;
+    std::chrono::milliseconds interval{0};  // 0 means steady
+    bool steady_state = false, led = false;
+    uint64_t signals = 0;
+
+    void apply_state()
+    {
+        steady_state = active_state == "active";
+        if (active_state == "failed") interval = fast_blink_interval;
+        else if (active_state == "activating" || active_state == "deactivating" || active_state == "reloading") interval = blink_interval;
+        else interval = std::chrono::milliseconds(0);
+        update(std::chrono::steady_clock::now());
+    }
+public:
+    UnitFollower(const std::string& action, const std::string& _unit) : DynamicAction(action), unit(_unit)
+    {
+        if (!bus_connection) throw std::runtime_error("No D-Bus connection");
+        //else
+        manager = sdbus::createProxy(*bus_connection, systemd, "/org/freedesktop/systemd1");
+        manager->finishRegistration();
+        sdbus::ObjectPath unit_path;
+        manager->callMethod("LoadUnit").onInterface("org.freedesktop.systemd1.Manager").withArguments(unit).storeResultsTo(unit_path);
+        // systemd only emits unit signals while at least one client is subscribed
+        manager->callMethod("Subscribe").onInterface("org.freedesktop.systemd1.Manager");
+
+        proxy = sdbus::createProxy(*bus_connection, systemd, unit_path);
+        proxy->uponSignal("PropertiesChanged").onInterface("org.freedesktop.DBus.Properties").call([this](const std::string& interface,
+            const std::map<std::string, sdbus::Variant>& changed, const std::vector<std::string>& /*invalidated*/) {
+            if (interface != "org.freedesktop.systemd1.Unit") return;
+            //else
+            signals++;
+            if (auto i = changed.find("ActiveState"); i != changed.end()) active_state = i->second.get<std::string>();
+            if (auto i = changed.find("SubState"); i != changed.end()) sub_state = i->second.get<std::string>();
+            apply_state();
+        });
+        proxy->finishRegistration();
+
+        sdbus::Variant value;
+        proxy->callMethod("Get").onInterface("org.freedesktop.DBus.Properties").withArguments("org.freedesktop.systemd1.Unit", "ActiveState").storeResultsTo(value);
+        active_state = value.get<std::string>();
+        proxy->callMethod("Get").onInterface("org.freedesktop.DBus.Properties").withArguments("org.freedesktop.systemd1.Unit", "SubState").storeResultsTo(value);
+        sub_state = value.get<std::string>();
+        apply_state();
+    }
+    ~UnitFollower()
+    {
+        try {
+            manager->callMethod("Unsubscribe").onInterface("org.freedesktop.systemd1.Manager");
+        }
+        catch (const sdbus::Error& err) {
+            // systemd keeps the subscription of other clients anyway
+        }
+    }
+
+    bool get_led_state() const override { return led; }
+
+    void update(std::chrono::steady_clock::time_point now) override
+    {
+        led = interval.count() == 0? steady_state : (std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) / interval) % 2 == 0;
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const override
+    {
+        if (interval.count() == 0) return std::chrono::steady_clock::time_point::max();
+        //else
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch());
+        return std::chrono::steady_clock::time_point((now / interval + 1) * interval);
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["unit.name"] = unit;
+        stats["unit.active_state"] = active_state;
+        stats["unit.sub_state"] = sub_state;
+        stats["unit.signals"] = std::to_string(signals);
+    }
+
+    double get_wakeups_per_second() const override { return interval.count() == 0? 0.0 : 1000.0 / interval.count(); }
+};
+#endif
+
+std::unique_ptr<DynamicAction> dynamic_action;
+
+// Disciplines the blink phase to rising edges of a reference pulse on an input line (e.g. a 1Hz sync line
+// shared by all boards in a rack) with a PI loop on the kernel's event timestamps, so that every board
+// blinks in unison.  Without the reference the loop keeps running on the last period estimate.
+class PhaseLock {
+    static constexpr double kp = 0.5, ki = 0.05;
+    static constexpr std::chrono::nanoseconds lock_threshold{std::chrono::milliseconds(1)}, unlock_threshold{std::chrono::milliseconds(5)};
+    static constexpr int edges_to_lock = 4;
+    gpiod::line line;
+    std::chrono::nanoseconds nominal_period, period, origin{0}, phase_error{0};
+    bool has_reference = false, locked = false;
+    int good_edges = 0;
+    uint64_t edges = 0;
+
+    void discipline(std::chrono::nanoseconds timestamp)
+    {
+        edges++;
+        if (!has_reference || timestamp - origin > 8 * period) {
+            // (re)acquire: jump straight to the reference edge
+            origin = timestamp;
+            period = nominal_period;
+            has_reference = true;
+            locked = false;
+            good_edges = 0;
+            return;
+        }
+        //else
+        auto cycles = std::max<int64_t>((timestamp - origin + period / 2) / period, 1);
+        origin += cycles * period;
+        phase_error = timestamp - origin;
+        origin += std::chrono::nanoseconds((int64_t)(kp * phase_error.count()));
+        period += std::chrono::nanoseconds((int64_t)(ki * phase_error.count() / cycles));
+        period = std::clamp(period, nominal_period * 99 / 100, nominal_period * 101 / 100);
+        auto abs_error = phase_error < phase_error.zero()? -phase_error : phase_error;
+        if (abs_error > unlock_threshold) {
+            locked = false;
+            good_edges = 0;
+        }
+        else if (abs_error < lock_threshold && ++good_edges >= edges_to_lock) locked = true;
+    }
+public:
+    PhaseLock(const gpiod::chip& chip, unsigned int line_num, std::chrono::nanoseconds _nominal_period)
+        : nominal_period(_nominal_period), period(_nominal_period)
+    {
+        line = chip.get_line(line_num);
+        line.request({"led-indicator", gpiod::line_request::EVENT_RISING_EDGE});
+    }
+    ~PhaseLock() { line.release(); }
+
+    int get_fd() const { return line.event_get_fd(); }
+    bool is_active() const { return has_reference; }
+
+    void handle_poll_event()
+    {
+        // event timestamps are CLOCK_MONOTONIC, the same clock as steady_clock
+        for (const auto& event : line.event_read_multiple()) {
+            if (event.event_type == gpiod::line_event::RISING_EDGE) discipline(event.timestamp);
+        }
+    }
+
+    // on during the first half of each reference period
+    bool get_blink_state(std::chrono::steady_clock::time_point now) const
+    {
+        auto phase = (now.time_since_epoch() - origin) % period;
+        if (phase < phase.zero()) phase += period;
+        return phase < period / 2;
+    }
+
+    std::chrono::steady_clock::time_point next_blink_edge(std::chrono::steady_clock::time_point now) const
+    {
+        auto half = period / 2;
+        auto elapsed = now.time_since_epoch() - origin;
+        auto n = elapsed < elapsed.zero()? 0 : elapsed / half + 1;
+        return std::chrono::steady_clock::time_point(origin + n * half);
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        stats["sync.state"] = locked? "locked" : has_reference? "acquiring" : "no reference";
+        stats["sync.edges"] = std::to_string(edges);
+        stats["sync.phase_error_us"] = std::to_string(phase_error.count() / 1000.0);
+        stats["sync.period_ns"] = std::to_string(period.count());
+    }
+};
+
+std::unique_ptr<PhaseLock> phase_lock;
+
+// The main LED as an RGB LED on three GPIO lines (common anode, i.e. active low, unless told otherwise).  A
+// PWM thread mixes the colour with per-channel gamma and dithering (see rgb.hpp) and sleeps while the
+// colour needs no PWM (off or full channels only).
+class RgbOutput {
+    gpiod::line_bulk lines;
+    std::vector<rgb::GammaLut> luts;
+    rgb::Modulator modulator;
+    std::chrono::nanoseconds period;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    rgb::Color target = {0, 0, 0};
+    bool stop_requested = false;
+    std::thread pwm;
+    std::atomic<uint64_t> periods{0}, writes{0}, cpu_ns{0};
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::string error;  // why the PWM thread stopped, guarded by mutex
+
+    void run()
+    {
+        sched_param param = {.sched_priority = 1};
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);  // best effort; needs CAP_SYS_NICE
+        rgb::Color color = {0, 0, 0};
+        std::array<uint32_t, 3> levels = {}, duties;
+        std::array<bool, 3> on = {false, false, false};
+        std::vector<int> values(3);
+        auto deadline = std::chrono::steady_clock::now();
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (modulator.is_steady(levels)) {
+                    changed.wait(lock, [&]() { return stop_requested || target != color; });
+                    deadline = std::chrono::steady_clock::now();
+                }
+                if (stop_requested) return;
+                //else
+                color = target;
+            }
+            for (int k = 0; k < 3; k++) levels[k] = luts[k][color[k]];
+            modulator.next(levels, duties);
+            writes += rgb::play_period(duties, modulator.steps(), deadline, period, on, [&](const std::array<bool, 3>& next) {
+                std::copy(next.begin(), next.end(), values.begin());
+                lines.set_values(values);
+            });
+            periods++;
+            deadline += period;
+            auto now = std::chrono::steady_clock::now();
+            if (now > deadline) deadline = now;  // fell behind; resync
+            rgb::sleep_until(deadline);  // also when the period needed no write
+            struct timespec cpu;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+            cpu_ns = (uint64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+        }
+    }
+public:
+    RgbOutput(const gpiod::chip& chip, const std::vector<unsigned int>& line_nums, bool common_cathode,
+        const std::vector<double>& gammas, unsigned int pwm_hz, unsigned int bits, bool dither)
+        : modulator(bits, dither)
+    {
+        if (line_nums.size() != 3) throw std::runtime_error("RGB LED needs exactly 3 lines (red, green, blue)");
+        if ((gammas.size() != 1 && gammas.size() != 3) || std::ranges::any_of(gammas, [](double g) { return g <= 0.0; })) {
+            throw std::runtime_error("RGB gamma needs 1 or 3 positive values");
+        }
+        if (pwm_hz == 0 || bits < 1 || bits > 16) throw std::runtime_error("Invalid RGB PWM frequency or bit depth");
+        //else
+        for (int k = 0; k < 3; k++) luts.emplace_back(gammas[gammas.size() == 3? k : 0]);
+        period = std::chrono::nanoseconds(std::chrono::seconds(1)) / pwm_hz;
+        lines = chip.get_lines(line_nums);
+        lines.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT,
+            common_cathode? 0 : gpiod::line_request::FLAG_ACTIVE_LOW}, std::vector<int>(3, 0));
+        pwm = std::thread([this]() {
+            try {
+                run();
+            }
+            catch (const std::exception& err) {
+                std::cerr << "RGB PWM stopped: " << err.what() << std::endl;
+                std::lock_guard<std::mutex> lock(mutex);
+                error = err.what();
+            }
+        });
+    }
+    ~RgbOutput()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop_requested = true;
+        }
+        changed.notify_all();
+        pwm.join();
+        lines.set_values(std::vector<int>(3, 0));
+        lines.release();
+    }
+
+    void set(const rgb::Color& color)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (target == color) return;
+            //else
+            target = color;
+        }
+        changed.notify_all();
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        stats["rgb.pwm_hz"] = std::to_string(std::chrono::seconds(1) / period);
+        stats["rgb.bits"] = std::to_string(modulator.get_bits());
+        stats["rgb.periods"] = std::to_string(periods);
+        stats["rgb.writes"] = std::to_string(writes);
+        stats["rgb.writes_per_second"] = std::to_string(writes / elapsed);
+        stats["rgb.cpu_percent"] = std::to_string(cpu_ns / elapsed / 1e7);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error.empty()) stats["rgb.error"] = error;
+    }
+};
+
+std::unique_ptr<RgbOutput> rgb_output;
+
+// The main LED on a kernel PWM channel (/sys/class/pwm/pwmchipN/pwmM) instead of a GPIO line, e.g. GPIO13 of
+// a Raspberry Pi with the pwm overlay.  Brightness is a duty cycle at a fixed carrier, and blinking is
+// handed to the hardware as a slow period when the driver accepts one, so neither costs a wakeup.
+// Everything else (dynamic actions, flashes, phase-locked blinking) is still timed by the service
+// loop, switching the duty between the level and 0.  The sysfs root is configurable so that the backend
+// can be exercised against a fake tree of plain files.
+class PwmOutput {
+    static constexpr uint64_t blink_half_period_ms = 500;  // as blink_interval
+    std::string chip_path, path;
+    unsigned int channel;
+    bool exported = false;
+    uint64_t period_ns = 0, duty_ns = 0;
+    bool blinking = false, blink_rejected = false;
+    uint64_t writes = 0;
+
+    bool write_attribute(const std::string& name, uint64_t value)
+    {
+        int fd = open((path + "/" + name).c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+        if (fd < 0) return false;
+        //else
+        auto str = std::to_string(value) + "\n";
+        bool ok = ::write(fd, str.data(), str.size()) == (ssize_t)str.size();
+        close(fd);
+        if (ok) writes++;
+        return ok;
+    }
+
+    // duty_cycle may never exceed period, so the order of the two writes depends on the direction
+    bool program(uint64_t new_period_ns, uint64_t new_duty_ns)
+    {
+        if (new_period_ns == period_ns && new_duty_ns == duty_ns) return true;
+        //else
+        bool ok;
+        if (new_period_ns >= period_ns) {
+            ok = (new_period_ns == period_ns || write_attribute("period", new_period_ns)) && write_attribute("duty_cycle", new_duty_ns);
+        } else {
+            ok = write_attribute("duty_cycle", std::min(new_duty_ns, duty_ns)) && write_attribute("period", new_period_ns)
+                && write_attribute("duty_cycle", new_duty_ns);
+        }
+        if (ok) {
+            period_ns = new_period_ns;
+            duty_ns = new_duty_ns;
+        }
+        return ok;
+    }
+public:
+    PwmOutput(const std::string& root, unsigned int chip, unsigned int _channel) : channel(_channel)
+    {
+        chip_path = root + "/pwmchip" + std::to_string(chip);
+        path = chip_path + "/pwm" + std::to_string(channel);
+        if (!std::filesystem::exists(path)) {
+            std::ofstream export_file(chip_path + "/export");
+            export_file << channel << std::endl;
+            if (!export_file || !std::filesystem::exists(path)) throw std::runtime_error("Unable to export PWM channel " + path);
+            exported = true;
+        }
+        if (!write_attribute("duty_cycle", 0) || !write_attribute("period", defaults::pwm_period_ns) || !write_attribute("enable", 1)) {
+            PERROR("Unable to set up PWM channel " + path);
+        }
+        period_ns = defaults::pwm_period_ns;
+        // probe whether the driver takes a blink period at all (typically EINVAL when the clock divider can't)
+        if (!program(2 * blink_half_period_ms * 1000000, 0)) blink_rejected = true;
+        if (!program(defaults::pwm_period_ns, 0)) PERROR("Unable to set up PWM channel " + path);
+    }
+    ~PwmOutput()
+    {
+        write_attribute("duty_cycle", 0);
+        write_attribute("enable", 0);
+        if (exported) std::ofstream(chip_path + "/unexport") << channel << std::endl;
+    }
+
+    const std::string& get_path() const { return path; }
+    bool is_blinking() const { return blinking; }
+    bool can_blink() const { return !blink_rejected; }
+
+    // level is 0..1 of full brightness
+    void set_level(double level)
+    {
+        if (!program(defaults::pwm_period_ns, std::llround(defaults::pwm_period_ns * std::clamp(level, 0.0, 1.0)))) {
+            PERROR("Unable to set PWM duty cycle of " + path);
+        }
+        blinking = false;
+    }
+
+    // starts a hardware blink (on for the first half of the period) unless the driver rejected one before;
+    // meant to be called on a rising edge so that the hardware continues the software phase
+    bool blink(std::chrono::nanoseconds period)
+    {
+        if (blinking && period_ns == (uint64_t)period.count()) return true;
+        if (blink_rejected) return false;
+        //else
+        if (!program(period.count(), period.count() / 2)) {
+            blink_rejected = true;  // typically EINVAL: period beyond what the PWM clock divider can do
+            return false;
+        }
+        blinking = true;
+        return true;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        stats["pwm.path"] = path;
+        stats["pwm.period_ns"] = std::to_string(period_ns);
+        stats["pwm.duty_ns"] = std::to_string(duty_ns);
+        stats["pwm.writes"] = std::to_string(writes);
+        stats["pwm.hardware_blink"] = blink_rejected? "unsupported" : "supported";
+    }
+};
+
+std::unique_ptr<PwmOutput> pwm_output;
+
+// The main LED as a kernel LED class device (/sys/class/leds/NAME, e.g. a gpio-leds LED that owns the
+// GPIO).  Besides setting the brightness, the kernel's own triggers (timer, disk-activity, netdev,
+// heartbeat) can take over whole patterns; which of them exist is probed at startup.
+class LedClassOutput {
+    std::string path;
+    unsigned int max_brightness = 1;
+    std::vector<std::string> triggers;
+    std::string trigger;
+    std::map<std::string, std::string> trigger_attributes;
+    std::optional<unsigned int> brightness;
+    uint64_t writes = 0;
+
+    bool write_attribute(const std::string& name, const std::string& value)
+    {
+        int fd = open((path + "/" + name).c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+        if (fd < 0) return false;
+        //else
+        auto str = value + "\n";
+        bool ok = ::write(fd, str.data(), str.size()) == (ssize_t)str.size();
+        close(fd);
+        if (ok) writes++;
+        return ok;
+    }
+public:
+    LedClassOutput(const std::string& root, const std::string& name) : path(root + "/" + name)
+    {
+        std::ifstream max_brightness_file(path + "/max_brightness"), trigger_file(path + "/trigger");
+        if (!(max_brightness_file >> max_brightness) || max_brightness == 0) throw std::runtime_error("No LED class device at " + path);
+        //else
+        for (std::string name; trigger_file >> name; ) {
+            // the active trigger is shown in brackets
+            if (name.starts_with('[') && name.ends_with(']')) name = name.substr(1, name.size() - 2);
+            triggers.push_back(name);
+        }
+        set_level(0.0);
+    }
+    ~LedClassOutput() { set_level(0.0); }
+
+    const std::string& get_path() const { return path; }
+    unsigned int get_max_brightness() const { return max_brightness; }
+    const std::vector<std::string>& get_triggers() const { return triggers; }
+    bool has_trigger(std::string_view name) const { return std::ranges::find(triggers, name) != triggers.end(); }
+    const std::string& get_trigger() const { return trigger; }
+
+    // level is 0..1 of max_brightness, with no trigger
+    void set_level(double level)
+    {
+        if (trigger != "none") {
+            if (!write_attribute("trigger", "none")) PERROR("Unable to set trigger of " + path);
+            trigger = "none";
+            trigger_attributes.clear();
+            brightness.reset();  // removing a trigger turns the LED off
+        }
+        unsigned int value = std::lround(max_brightness * std::clamp(level, 0.0, 1.0));
+        if (brightness == value) return;
+        //else
+        if (!write_attribute("brightness", std::to_string(value))) PERROR("Unable to set brightness of " + path);
+        brightness = value;
+    }
+
+    // the trigger's attributes only appear once it is active, so they are written after it
+    void set_trigger(const std::string& name, const std::map<std::string, std::string>& attributes)
+    {
+        if (trigger == name && trigger_attributes == attributes) return;
+        //else
+        if (!write_attribute("trigger", name)) PERROR("Unable to set trigger of " + path);
+        for (const auto& [attribute, value] : attributes) {
+            if (!write_attribute(attribute, value)) PERROR("Unable to set " + attribute + " of " + path);
+        }
+        trigger = name;
+        trigger_attributes = attributes;
+        brightness.reset();
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        stats["ledclass.path"] = path;
+        stats["ledclass.trigger"] = trigger;
+        stats["ledclass.writes"] = std::to_string(writes);
+    }
+};
+
+std::unique_ptr<LedClassOutput> led_class_output;
+
+const std::chrono::milliseconds blink_interval(500);
+
+bool get_expected_led_state() {
+    if (led_action == LED_ON) return true;
+    if (led_action == LED_OFF) return false;
+    if (led_action == LED_DYNAMIC) return dynamic_action->get_led_state();
+    //else
+    if (phase_lock && phase_lock->is_active()) return phase_lock->get_blink_state(std::chrono::steady_clock::now());
+    //else
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()) / blink_interval) % 2 == 0;
+}
+
+// when the LED has to be re-evaluated next without any fd activity
+std::chrono::steady_clock::time_point get_next_led_deadline()
+{
+    if (led_action == LED_DYNAMIC) return dynamic_action->next_deadline();
+    if (led_action != LED_BLINK) return std::chrono::steady_clock::time_point::max();
+    //else
+    auto now = std::chrono::steady_clock::now();
+    if (phase_lock && phase_lock->is_active()) return phase_lock->next_blink_edge(now);
+    //else
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    return now + ((since_epoch / blink_interval + 1) * blink_interval - since_epoch);
+}
+
+// timed sequences of internal components run as coroutines on the service thread
+sequencer::Scheduler scheduler;
+
+// One-shot flashes requested through the trigger FIFO invert the LED on top of the current action.  Same
+// timing as Flasher, written as a sequence on the scheduler: triggers during a flash or its off gap are
+// coalesced into one further flash.
+class FlashSequence {
+    sequencer::Event triggered;
+    bool pending = false, led = false, busy = false;
+
+    sequencer::Task run()
+    {
+        for (;;) {
+            busy = false;
+            if (!pending) co_await sequencer::on_event(triggered);
+            busy = true;
+            pending = false;
+            led = true;
+            co_await sequencer::sleep_until(sequencer::clock::now() + flash_on_time);
+            led = false;
+            co_await sequencer::sleep_until(sequencer::clock::now() + flash_off_time);
+        }
+    }
+public:
+    void start(sequencer::Scheduler& scheduler) { scheduler.spawn(run()); }
+    void trigger()
+    {
+        pending = true;
+        triggered.notify();
+    }
+    bool get_led_state() const { return led; }
+    bool is_idle() const { return !busy && !pending; }
+};
+
+FlashSequence flash_overlay;
+
+// returns the argument of a "name" or "name=argument" style action
+std::optional<std::string> match_action(const std::string& action, std::string_view name)
+{
+    if (action == name) return std::string();
+    if (action.starts_with(name) && action.size() > name.size() && action[name.size()] == '=') return action.substr(name.size() + 1);
+    //else
+    return std::nullopt;
+}
+
+std::string format_color(const rgb::Color& color)
+{
+    char buf[8];
+    snprintf(buf, sizeof(buf), "#%02x%02x%02x", color[0], color[1], color[2]);
+    return buf;
+}
+
+// color:#rrggbb, color-blink:#rrggbb (alternating with off) or color-blink:#rrggbb,#rrggbb
+std::optional<LedColors> parse_color_action(const std::string& action)
+{
+    std::string_view colors;
+    if (action.starts_with("color:")) colors = std::string_view(action).substr(6);
+    else if (action.starts_with("color-blink:")) colors = std::string_view(action).substr(12);
+    else return std::nullopt;
+    //else
+    LedColors result;
+    auto comma = colors.find(',');
+    auto on = render::parse_color(colors.substr(0, comma));
+    if (!on) return std::nullopt;
+    //else
+    result.on = *on;
+    if (comma == std::string_view::npos) return result;
+    //else
+    auto off = render::parse_color(colors.substr(comma + 1));
+    if (!off || action.starts_with("color:")) return std::nullopt;
+    //else
+    result.off = *off;
+    return result;
+}
+
+bool apply_led_action(const std::string& action)
+{
+    try {
+        if (action == "on" || action == "off" || action == "blink") {
+            led_action = action == "on"? LED_ON : action == "off"? LED_OFF : LED_BLINK;
+            led_colors = LedColors();
+            led_brightness = 100;
+        }
+        else if (action.starts_with("dim:")) {
+            auto digits = std::string_view(action).substr(4);
+            unsigned int percent;
+            auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), percent);
+            bool dimmable = pwm_output || (led_class_output && led_class_output->get_max_brightness() > 1);
+            if (ec != std::errc() || ptr != digits.data() + digits.size() || !dimmable || percent < 1 || percent > 100) return false;
+            //else
+            led_brightness = percent;
+            led_action = LED_ON;
+        }
+        else if (auto colors = parse_color_action(action)) {
+            if (!rgb_output) return false;
+            //else
+            led_colors = *colors;
+            led_action = action.starts_with("color:")? LED_ON : LED_BLINK;
+        }
+        else if (auto device = match_action(action, "activity:disk")) {
+            dynamic_action = std::make_unique<ActivityMonitor>(std::make_unique<DiskActivitySource>(*device), action);
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+        else if (auto interfaces = match_action(action, "activity:net")) {
+            dynamic_action = std::make_unique<ActivityMonitor>(std::make_unique<NetActivitySource>(*interfaces), action);
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+        else if (action.starts_with("watch:") && action.size() > 6) {
+            dynamic_action = std::make_unique<WatchTrigger>(action, action.substr(6));
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+#ifndef NO_DBUS
+        else if (action.starts_with("follow-unit:") && action.size() > 12) {
+            dynamic_action = std::make_unique<UnitFollower>(action, action.substr(12));
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+#endif
+        else if (action.starts_with("transmit:")) {
+            dynamic_action = std::make_unique<Transmitter>(action, action.substr(9), transmit_baud);
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+        else if (action == "heartbeat:load") {
+            dynamic_action = std::make_unique<LoadHeartbeat>(action);
+            led_action = LED_DYNAMIC;
+            return true;
+        }
+        else return false;
+    }
+    catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        return false;
+    }
+    //else
+    dynamic_action.reset();
+    return true;
+}
+
+// Version of the service state (the main LED's action and the panel LEDs), incremented by every change.
+// Clients pass the version they last saw to setIf, which makes read-decide-write a single request.
+uint64_t state_version = 0;
+
+bool set_led_action(const std::string& action)
+{
+    if (!apply_led_action(action)) return false;
+    //else
+    state_version++;
+    return true;
+}
+
+std::string get_led_action()
+{
+    if (led_action == LED_DYNAMIC) return dynamic_action->get_action();
+    //else
+    if (led_brightness < 100 && led_action == LED_ON) return "dim:" + std::to_string(led_brightness);
+    //else
+    if (led_colors != LedColors() && led_action != LED_OFF) {
+        if (led_action == LED_ON) return "color:" + format_color(led_colors.on);
+        //else
+        return "color-blink:" + format_color(led_colors.on) + (led_colors.off != rgb::Color{0, 0, 0}? "," + format_color(led_colors.off) : "");
+    }
+    //else
+    return led_action == LED_ON? "on" : led_action == LED_OFF? "off" : "blink";
+}
+
+// compare-and-set: the action is taken only if nothing changed the state since expected_version
+bool set_led_action_if(uint64_t expected_version, const std::string& action)
+{
+    if (state_version != expected_version) return false;
+    //else
+    return set_led_action(action);
+}
+
+// the same, conditional on the current action instead of the version
+bool set_led_action_if_state(const std::string& expected_action, const std::string& action)
+{
+    if (get_led_action() != expected_action) return false;
+    //else
+    return set_led_action(action);
+}
+
+// Calls to waitChange whose replies are deferred until the state version moves past last_version or the
+// deadline passes.  A pending call is just an entry here; the loop checks them after every iteration.
+// Every call times out within max_wait_change_ms, before a D-Bus caller gives up on it, and a Varlink
+// client's call goes when its connection does, so entries of callers that have gone do not pile up.
+struct ChangeWaiter {
+    uint64_t last_version;
+    std::chrono::steady_clock::time_point deadline;
+    std::move_only_function<void()> reply;  // answers with the current state
+    uint64_t varlink_client;                // Varlink client id, 0 for D-Bus callers
+};
+std::vector<ChangeWaiter> change_waiters;
+uint64_t change_waits = 0;
+
+// the caller answers at once instead if the version has already moved; timeout_ms 0 means the longest wait
+void add_change_waiter(uint64_t last_version, uint32_t timeout_ms, std::move_only_function<void()> reply, uint64_t varlink_client = 0)
+{
+    if (timeout_ms == 0 || timeout_ms > defaults::max_wait_change_ms) timeout_ms = defaults::max_wait_change_ms;
+    change_waiters.push_back({last_version, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms), std::move(reply), varlink_client});
+    change_waits++;
+}
+
+void drop_change_waiters(uint64_t varlink_client)
+{
+    std::erase_if(change_waiters, [varlink_client](const ChangeWaiter& waiter) { return waiter.varlink_client == varlink_client; });
+}
+
+std::chrono::steady_clock::time_point next_change_waiter_deadline()
+{
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    for (const auto& waiter : change_waiters) deadline = std::min(deadline, waiter.deadline);
+    return deadline;
+}
+
+void answer_change_waiters(std::chrono::steady_clock::time_point now)
+{
+    // taken out first: a reply lets a Varlink client's next call through, which may add a waiter
+    std::vector<ChangeWaiter> due;
+    for (auto i = change_waiters.begin(); i != change_waiters.end(); ) {
+        if (i->last_version == state_version && i->deadline > now) {
+            ++i;
+            continue;
+        }
+        //else
+        due.push_back(std::move(*i));
+        i = change_waiters.erase(i);
+    }
+    for (auto& waiter : due) waiter.reply();
+}
+
+class Ws2812Output;
+Ws2812Output* main_strip = nullptr;  // the strip when it also shows the main LED
+
+// One way of driving the main LED for the current action.  The backends that can reach the LED are probed
+// at startup (the kernel LED's triggers, whether the PWM takes a blink period); for every action each of
+// them proposes a plan, and the one costing the fewest userspace wakeups wins, earlier backends (kernel
+// LED, then PWM) on ties.  A plan that needs the service loop to time the pattern says so (userspace).
+struct Plan {
+    std::string backend = {};  // led-class, pwm, rgb or gpio
+    std::string method = {};
+    bool userspace = false;
+    double wakeups_per_second = 0.0;
+    std::string trigger = {};  // kernel LED trigger taking over the pattern
+    std::map<std::string, std::string> trigger_attributes = {};
+    bool operator==(const Plan&) const = default;
+};
+
+Plan main_plan;
+// what the plan was made for: the state version, whether no flash was pending and whether the blink phase
+// was locked.  The backends are fixed at startup, so the plan only changes with these.
+std::optional<std::tuple<uint64_t, bool, bool>> main_plan_inputs;
+std::chrono::steady_clock::time_point main_plan_since;
+uint64_t loop_wakeups = 0, main_plan_wakeups = 0;  // service loop iterations in total and when main_plan took effect
+
+// what timing the current action in the service loop costs, from whichever backend
+double get_userspace_wakeups_per_second()
+{
+    if (led_action == LED_BLINK) return 1000.0 / blink_interval.count();
+    if (led_action == LED_DYNAMIC) return dynamic_action->get_wakeups_per_second();
+    //else
+    return 0.0;
+}
+
+Plan plan_main_led()
+{
+    auto action = get_led_action();
+    bool idle_overlay = flash_overlay.is_idle();
+    bool steady = (led_action == LED_ON || led_action == LED_OFF) && idle_overlay;
+    bool plain_blink = led_action == LED_BLINK && !(phase_lock && phase_lock->is_active()) && idle_overlay;
+    Plan software{.method = "software timing", .userspace = true, .wakeups_per_second = get_userspace_wakeups_per_second()};
+
+    std::vector<Plan> plans;
+    if (led_class_output) {
+        Plan plan = software;
+        auto interfaces = match_action(action, "activity:net");
+        if (steady && (led_brightness == 100 || led_class_output->get_max_brightness() > 1)) plan = {.method = "brightness"};
+        else if (plain_blink && led_class_output->has_trigger("timer")) {
+            auto ms = std::to_string(blink_interval.count());
+            plan = {.method = "timer trigger", .trigger = "timer", .trigger_attributes = {{"delay_on", ms}, {"delay_off", ms}}};
+        }
+        else if (idle_overlay && action == "activity:disk" && led_class_output->has_trigger("disk-activity")) {
+            plan = {.method = "disk-activity trigger", .trigger = "disk-activity"};
+        }
+        else if (idle_overlay && interfaces && !interfaces->empty() && interfaces->find(',') == std::string::npos && led_class_output->has_trigger("netdev")) {
+            plan = {.method = "netdev trigger", .trigger = "netdev", .trigger_attributes = {{"device_name", *interfaces}, {"rx", "1"}, {"tx", "1"}}};
+        }
+        else if (idle_overlay && action == "heartbeat:load" && led_class_output->has_trigger("heartbeat")) {
+            plan = {.method = "heartbeat trigger", .trigger = "heartbeat"};
+        }
+        plan.backend = "led-class";
+        plans.push_back(plan);
+    }
+    if (pwm_output) {
+        Plan plan = software;
+        if (steady) plan = {.method = "hardware level"};
+        else if (plain_blink && pwm_output->can_blink()) plan = {.method = "hardware blink"};
+        plan.backend = "pwm";
+        plans.push_back(plan);
+    }
+    if (plans.empty()) {
+        Plan plan = software;
+        std::string backend = rgb_output? "rgb" : main_strip? "strip" : "gpio";
+        if (steady) plan = {.method = backend + " level"};
+        plan.backend = backend;
+        plans.push_back(plan);
+    }
+    return *std::ranges::min_element(plans, [](const Plan& a, const Plan& b) {
+        return a.wakeups_per_second < b.wakeups_per_second || (a.wakeups_per_second == b.wakeups_per_second && !a.userspace && b.userspace);
+    });
+}
+
+// whether the hardware or the kernel runs the pattern right now, so the loop need not time it; a blink
+// is only handed over on its next rising edge to keep the phase
+bool is_main_led_offloaded()
+{
+    if (main_plan.userspace) return false;
+    if (main_plan.backend == "pwm" && main_plan.method == "hardware blink") return pwm_output->is_blinking();
+    if (main_plan.backend == "led-class" && !main_plan.trigger.empty()) return led_class_output->get_trigger() == main_plan.trigger;
+    //else
+    return true;
+}
+
+void apply_main_led_plan(gpiod::line& line, bool expected_led_state)
+{
+    auto level = expected_led_state? led_brightness / 100.0 : 0.0;
+    if (main_plan.backend == "led-class") {
+        bool hand_over = !main_plan.trigger.empty() && (main_plan.trigger != "timer" || is_main_led_offloaded() || expected_led_state);
+        if (hand_over) led_class_output->set_trigger(main_plan.trigger, main_plan.trigger_attributes);
+        else led_class_output->set_level(level);
+    } else if (main_plan.backend == "pwm") {
+        bool hand_over = main_plan.method == "hardware blink" && (pwm_output->is_blinking() || expected_led_state) && pwm_output->blink(blink_interval * 2);
+        if (!hand_over) pwm_output->set_level(level);
+    } else if (main_plan.backend == "gpio" && line.get_value() != expected_led_state) {
+        line.set_value(expected_led_state);
+    }
+}
+
+// Single-byte commands from a named pipe: '1' on, '0' off, 'b' blink, 'f' flash.  Whatever is queued is
+// read in one go and only the last state command of a batch is applied, and only if it changes anything.
+class TriggerFifo {
+    std::string path;
+    int fd, writer_fd;
+    uint64_t bytes = 0, commands = 0, applied = 0;
+public:
+    TriggerFifo(const std::string& _path) : path(_path)
+    {
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+        if (mkfifo(path.c_str(), 0620) < 0 && (errno != EEXIST || !std::filesystem::is_fifo(path))) PERROR("mkfifo(" + path + ")");
+        fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) PERROR("open(" + path + ")");
+        // holding a writer open ourselves keeps poll() from reporting POLLHUP each time a client closes
+        writer_fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (writer_fd < 0) {
+            close(fd);
+            PERROR("open(" + path + ")");
+        }
+    }
+    ~TriggerFifo()
+    {
+        close(writer_fd);
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    int get_fd() const { return fd; }
+
+    void handle_poll_event()
+    {
+        char buf[4096];
+        const char* action = nullptr;
+        bool flash = false;
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            bytes += n;
+            for (ssize_t i = 0; i < n; i++) {
+                switch (buf[i]) {
+                case '1': action = "on"; break;
+                case '0': action = "off"; break;
+                case 'b': action = "blink"; break;
+                case 'f': flash = true; break;
+                default: continue;  // newlines etc.
+                }
+                commands++;
+            }
+        }
+        if (n < 0 && errno != EAGAIN) PERROR("read(" + path + ")");
+        if (action && get_led_action() != action) {
+            set_led_action(action);
+            applied++;
+        }
+        if (flash) {
+            flash_overlay.trigger();
+            applied++;
+        }
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        stats["fifo.bytes"] = std::to_string(bytes);
+        stats["fifo.commands"] = std::to_string(commands);
+        stats["fifo.applied"] = std::to_string(applied);
+        stats["fifo.collapsed"] = std::to_string(commands - applied);
+    }
+};
+
+std::unique_ptr<TriggerFifo> trigger_fifo;
+
+// A push button wired between an input line and GND.  Edges are debounced using the kernel's event
+// timestamps: an edge closer than button_debounce_time to the previously accepted one is a bounce.  Since
+// a bounce may hide a genuine change (a release right after the press), the line is read again once
+// button_debounce_time has passed without edges, and a changed level is taken as the settled state.
+class Button {
+    unsigned int line_num;
+    std::string action;
+    gpiod::line line;
+    std::chrono::nanoseconds last_edge{0};
+    std::chrono::steady_clock::time_point settle_at = std::chrono::steady_clock::time_point::max();
+    bool pressed = false;
+    uint64_t presses = 0, bounces = 0;
+public:
+    Button(const gpiod::chip& chip, const std::string& spec)
+    {
+        auto colon = spec.find(':');
+        auto number = std::string_view(spec).substr(0, colon);
+        auto [ptr, ec] = std::from_chars(number.data(), number.data() + number.size(), line_num);
+        if (ec != std::errc() || ptr != number.data() + number.size()) throw std::runtime_error("Invalid --button " + spec + " (LINE[:ACTION] expected)");
+        //else
+        action = colon == std::string::npos? "toggle" : spec.substr(colon + 1);
+        if (action != "toggle" && action != "ack" && action != "cycle") throw std::runtime_error("Unknown button action: " + action);
+        //else
+        line = chip.get_line(line_num);
+        line.request({"led-indicator", gpiod::line_request::EVENT_BOTH_EDGES,
+            gpiod::line_request::FLAG_ACTIVE_LOW | gpiod::line_request::FLAG_BIAS_PULL_UP});
+    }
+    ~Button() { line.release(); }
+
+    unsigned int get_line_num() const { return line_num; }
+    const std::string& get_action() const { return action; }
+    int get_fd() const { return line.event_get_fd(); }
+
+    // returns the number of debounced presses among the queued events
+    int handle_poll_event()
+    {
+        int new_presses = 0;
+        for (const auto& event : line.event_read_multiple()) {
+            if (event.timestamp - last_edge < button_debounce_time) {
+                bounces++;
+                settle_at = std::chrono::steady_clock::now() + button_debounce_time;
+                continue;
+            }
+            //else
+            last_edge = event.timestamp;
+            bool now_pressed = event.event_type == gpiod::line_event::RISING_EDGE;
+            if (now_pressed && !pressed) new_presses++;
+            pressed = now_pressed;
+        }
+        presses += new_presses;
+        return new_presses;
+    }
+
+    std::chrono::steady_clock::time_point next_deadline() const { return settle_at; }
+
+    // re-reads the line once bouncing has stopped; returns 1 if the settled state is a new press
+    int settle(std::chrono::steady_clock::time_point now)
+    {
+        if (now < settle_at) return 0;
+        //else
+        settle_at = std::chrono::steady_clock::time_point::max();
+        bool now_pressed = line.get_value();
+        int new_presses = now_pressed && !pressed;
+        pressed = now_pressed;
+        presses += new_presses;
+        return new_presses;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const
+    {
+        auto prefix = "button." + std::to_string(line_num) + ".";
+        stats[prefix + "action"] = action;
+        stats[prefix + "presses"] = std::to_string(presses);
+        stats[prefix + "bounces"] = std::to_string(bounces);
+    }
+};
+
+std::vector<std::unique_ptr<Button>> buttons;
+
+std::chrono::steady_clock::time_point next_button_deadline()
+{
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    for (const auto& button : buttons) deadline = std::min(deadline, button->next_deadline());
+    return deadline;
+}
+
+void apply_button_action(const std::string& action)
+{
+    auto current = get_led_action();
+    if (action == "toggle") set_led_action(current == "on"? "off" : "on");
+    else if (action == "ack") set_led_action("off");
+    else if (action == "cycle") set_led_action(current == "off"? "on" : current == "on"? "blink" : "off");
+}
+
+// Additional indicator LEDs ("panel") beside the main one.  Their patterns live on the sparse timeline
+// and every frame change goes out in a single bulk write.
+class PanelOutput {
+public:
+    virtual ~PanelOutput() = default;
+    virtual void write(const uint64_t* bits, size_t count) = 0;
+    virtual void get_stats(std::map<std::string, std::string>& /*stats*/) const {}
+    // effects spanning several LEDs starting at first; an empty spec removes the one starting there
+    virtual bool set_effect(size_t /*first*/, const std::string& /*spec*/) { return false; }
+    virtual std::optional<std::string> get_effect(size_t /*first*/) const { return std::nullopt; }
+};
+
+class GpioPanelOutput : public PanelOutput {
+    gpiod::line_bulk lines;
+    std::vector<int> values;
+    uint64_t writes = 0;
+public:
+    GpioPanelOutput(const gpiod::chip& chip, const std::vector<unsigned int>& line_nums) : values(line_nums.size(), 0)
+    {
+        lines = chip.get_lines(line_nums);
+        lines.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT}, values);
+    }
+    ~GpioPanelOutput() { lines.release(); }
+
+    void write(const uint64_t* bits, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++) values[i] = frame::get_bit(bits, i);
+        lines.set_values(values);  // one ioctl for all lines
+        writes++;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        stats["panel.output"] = "gpio";
+        stats["panel.writes"] = std::to_string(writes);
+    }
+};
+
+// Daisy-chained 74HC595 shift registers bit-banged through three lines (data, clock, latch).  The chain is
+// only shifted out when the frame differs from the one latched last.  Each bit costs two bulk writes: data
+// and the falling clock edge change together, then the clock rises.
+class ShiftRegisterOutput : public PanelOutput {
+    enum { DATA, CLOCK, LATCH };
+    gpiod::line_bulk lines;
+    std::vector<int> values = {0, 0, 0};
+    std::vector<uint64_t> latched;
+    bool first = true;
+    uint64_t frames = 0, skipped = 0, ioctls = 0;
+    std::chrono::nanoseconds shift_time{0}, max_shift_time{0};
+    std::chrono::steady_clock::time_point started;
+
+    void set(int data, int clock, int latch)
+    {
+        values[DATA] = data;
+        values[CLOCK] = clock;
+        values[LATCH] = latch;
+        lines.set_values(values);
+        ioctls++;
+    }
+public:
+    ShiftRegisterOutput(const gpiod::chip& chip, const std::vector<unsigned int>& line_nums)
+    {
+        if (line_nums.size() != 3) throw std::runtime_error("Shift register needs data, clock and latch lines");
+        //else
+        lines = chip.get_lines(line_nums);
+        lines.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT}, values);
+        started = std::chrono::steady_clock::now();
+    }
+    ~ShiftRegisterOutput() { lines.release(); }
+
+    void write(const uint64_t* bits, size_t count) override
+    {
+        auto words = (count + 63) / 64;
+        if (!first && std::equal(bits, bits + words, latched.begin())) {
+            skipped++;
+            return;
+        }
+        //else
+        auto start = std::chrono::steady_clock::now();
+        // the first bit shifted in ends up in the last register, so LED 0 goes last
+        for (size_t i = count; i-- > 0; ) {
+            set(frame::get_bit(bits, i), 0, 0);
+            set(values[DATA], 1, 0);
+        }
+        set(values[DATA], 0, 1);
+        set(values[DATA], 0, 0);
+        latched.assign(bits, bits + words);
+        first = false;
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        shift_time += elapsed;
+        max_shift_time = std::max(max_shift_time, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        frames++;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        stats["panel.output"] = "74hc595";
+        stats["panel.frames"] = std::to_string(frames);
+        stats["panel.frames_skipped"] = std::to_string(skipped);
+        stats["panel.fps"] = std::to_string(frames / std::max(elapsed, 1e-9));
+        stats["panel.ioctls"] = std::to_string(ioctls);
+        stats["panel.shift_us_avg"] = std::to_string(frames? std::chrono::duration<double, std::micro>(shift_time).count() / frames : 0.0);
+        stats["panel.shift_us_max"] = std::to_string(std::chrono::duration<double, std::micro>(max_shift_time).count());
+    }
+};
+
+// Row/column multiplexed LED matrix: rows are driven high one at a time while the column lines sink
+// current (low = LED on) for that row.  A dedicated thread scans the rows with absolute deadlines,
+// switching all lines of a row in one bulk write.  Frames are handed over through a lock-free triple
+// buffer, so a scan always shows one complete frame.  Late row switches show up as ghosting, so row
+// lateness and scan-period jitter are measured.
+class MatrixOutput : public PanelOutput {
+    static constexpr unsigned dirty = 4;
+    size_t rows, cols;
+    gpiod::line_bulk lines;  // rows first, then columns
+    std::vector<uint64_t> buffers[3];
+    unsigned back = 0, front = 1;
+    std::atomic<unsigned> middle{2};
+    std::chrono::nanoseconds row_dwell;
+    std::atomic<bool> stop_requested{false};
+    std::thread scanner;
+
+    mutable std::mutex stats_mutex;
+    uint64_t scans = 0, late_rows = 0;
+    std::chrono::nanoseconds max_row_lateness{0}, total_row_lateness{0};
+    double scan_error_sq_sum = 0.0;  // us^2
+    std::string error;  // why scanning stopped
+
+    void scan()
+    {
+        sched_param param = {.sched_priority = 1};
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);  // best effort; needs CAP_SYS_NICE
+        std::vector<int> values(rows + cols);
+        auto deadline = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point previous_scan_start;
+        while (!stop_requested.load(std::memory_order_relaxed)) {
+            if (middle.load(std::memory_order_relaxed) & dirty) front = middle.exchange(front, std::memory_order_acq_rel) & ~dirty;
+            const auto& bits = buffers[front];
+            std::chrono::nanoseconds lateness_sum{0}, lateness_max{0};
+            uint64_t late = 0;
+            std::chrono::steady_clock::time_point scan_start;
+            for (size_t row = 0; row < rows; row++) {
+                for (size_t r = 0; r < rows; r++) values[r] = r == row;
+                for (size_t c = 0; c < cols; c++) values[rows + c] = !frame::get_bit(bits.data(), row * cols + c);
+                struct timespec ts;
+                auto since_epoch = deadline.time_since_epoch();
+                ts.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+                ts.tv_nsec = (since_epoch % std::chrono::seconds(1)).count();
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) ;
+                auto now = std::chrono::steady_clock::now();
+                lines.set_values(values);
+                auto lateness = now - deadline;
+                lateness_sum += lateness;
+                lateness_max = std::max(lateness_max, std::chrono::duration_cast<std::chrono::nanoseconds>(lateness));
+                if (lateness > row_dwell / 10) late++;
+                if (row == 0) scan_start = now;
+                deadline += row_dwell;
+                if (now > deadline + row_dwell * rows) deadline = now;  // fell a whole scan behind; resync
+            }
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            if (scans > 0) {
+                double error_us = std::chrono::duration<double, std::micro>((scan_start - previous_scan_start) - row_dwell * rows).count();
+                scan_error_sq_sum += error_us * error_us;
+            }
+            previous_scan_start = scan_start;
+            scans++;
+            late_rows += late;
+            total_row_lateness += lateness_sum;
+            max_row_lateness = std::max(max_row_lateness, lateness_max);
+        }
+    }
+public:
+    MatrixOutput(const gpiod::chip& chip, const std::vector<unsigned int>& row_line_nums, const std::vector<unsigned int>& col_line_nums, unsigned int refresh_hz)
+        : rows(row_line_nums.size()), cols(col_line_nums.size())
+    {
+        if (rows == 0 || cols == 0 || refresh_hz == 0) throw std::runtime_error("Matrix needs row lines, column lines and a refresh rate");
+        //else
+        auto line_nums = row_line_nums;
+        line_nums.insert(line_nums.end(), col_line_nums.begin(), col_line_nums.end());
+        lines = chip.get_lines(line_nums);
+        std::vector<int> initial(rows + cols, 0);
+        std::fill(initial.begin() + rows, initial.end(), 1);
+        lines.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT}, initial);
+        for (auto& buffer : buffers) buffer.assign((rows * cols + 63) / 64, 0);
+        row_dwell = std::chrono::nanoseconds(std::chrono::seconds(1)) / (refresh_hz * rows);
+        scanner = std::thread([this]() {
+            try {
+                scan();
+            }
+            catch (const std::exception& err) {
+                std::cerr << "Matrix scanning stopped: " << err.what() << std::endl;
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                error = err.what();
+            }
+        });
+    }
+    ~MatrixOutput()
+    {
+        stop_requested = true;
+        scanner.join();
+        std::vector<int> values(rows + cols, 0);
+        std::fill(values.begin() + rows, values.end(), 1);
+        lines.set_values(values);
+        lines.release();
+    }
+
+    size_t size() const { return rows * cols; }
+
+    void write(const uint64_t* bits, size_t /*count*/) override
+    {
+        std::copy(bits, bits + buffers[back].size(), buffers[back].begin());
+        back = middle.exchange(back | dirty, std::memory_order_acq_rel) & ~dirty;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats["panel.output"] = "matrix " + std::to_string(rows) + "x" + std::to_string(cols);
+        stats["panel.row_dwell_us"] = std::to_string(std::chrono::duration<double, std::micro>(row_dwell).count());
+        stats["panel.scans"] = std::to_string(scans);
+        stats["panel.late_rows"] = std::to_string(late_rows);
+        stats["panel.row_lateness_us_avg"] = std::to_string(scans? std::chrono::duration<double, std::micro>(total_row_lateness).count() / (scans * rows) : 0.0);
+        stats["panel.row_lateness_us_max"] = std::to_string(std::chrono::duration<double, std::micro>(max_row_lateness).count());
+        stats["panel.scan_jitter_us_rms"] = std::to_string(scans > 1? std::sqrt(scan_error_sq_sum / (scans - 1)) : 0.0);
+        if (!error.empty()) stats["panel.error"] = error;
+    }
+};
+
+// WS2812 addressable strip on SPI MOSI: panel LED i is pixel i, lit in the configured colour.  Ranges of
+// pixels can also carry effects (see render.hpp), which the panel LEDs are drawn over.  Each frame is
+// encoded into the SPI bitstream and sent as one SPI message, split into transfers of at most
+// max_transfer bytes that the controller sends back to back.  The device may also be a plain file, which
+// receives the raw bitstream, for testing without hardware.
+//
+// Without a frame rate a frame is rendered and sent whenever the panel changes.  With one, a render thread
+// produces frames on the frame clock across a WorkerPool while a writer thread encodes and sends the
+// previous frame from the other buffer, so rendering frame N+1 overlaps the output of frame N.  While no
+// effect is animated and nothing changes, the render thread waits instead of re-sending the same frame.
+class Ws2812Output : public PanelOutput {
+    static constexpr size_t grain = 256;  // pixels per work chunk
+    static constexpr size_t max_transfer = 4096;  // some controllers limit the length of a single transfer
+    std::string path;
+    int fd;
+    bool spidev;
+    size_t pixels;
+    std::array<uint8_t, 3> on_rgb;
+    std::vector<uint8_t> spi;
+    std::vector<spi_ioc_transfer> transfers;
+
+    // what write() and set_effect() hand over to rendering
+    mutable std::mutex state_mutex;
+    std::vector<uint64_t> bits;
+    std::vector<render::Effect> effects;
+    std::optional<size_t> main_pixel;  // the main LED, drawn over whatever the panel shows there
+    bool main_on = false;
+    bool state_changed = true;
+    bool stopping = false;
+    std::condition_variable state_changes;  // wakes an idle render thread
+
+    unsigned int fps;
+    std::unique_ptr<render::WorkerPool> pool;
+    std::vector<uint8_t> grb[2];
+    unsigned back = 0;
+    std::mutex handoff_mutex;
+    std::condition_variable handoff;
+    bool pending = false, stop_requested = false;  // pending: grb[back ^ 1] waits for the writer
+    std::thread renderer, writer;
+
+    mutable std::mutex stats_mutex;
+    uint64_t renders = 0, frames = 0, late_frames = 0;
+    std::chrono::nanoseconds render_time{0}, encode_time{0}, write_time{0};
+    std::chrono::nanoseconds last_render{0}, last_encode{0}, last_write{0}, max_render{0};
+    std::string error;  // why the render and writer threads stopped
+
+    void send(const std::vector<uint8_t>& frame_grb)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ws2812::encode(frame_grb.data(), frame_grb.size(), spi.data());
+        auto encoded = std::chrono::steady_clock::now();
+        if (spidev) {
+            if (ioctl(fd, SPI_IOC_MESSAGE(transfers.size()), transfers.data()) < 0) PERROR("SPI_IOC_MESSAGE(" + path + ")");
+        } else {
+            if (pwrite(fd, spi.data(), spi.size(), 0) < 0) PERROR("pwrite(" + path + ")");
+        }
+        auto written = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        last_encode = encoded - start;
+        last_write = written - encoded;
+        encode_time += last_encode;
+        write_time += last_write;
+        frames++;
+    }
+
+    void draw_main(bool on, uint8_t* frame_grb) const
+    {
+        if (!main_pixel) return;
+        //else
+        auto pixel = frame_grb + *main_pixel * 3;
+        pixel[0] = on? on_rgb[1] : 0;
+        pixel[1] = on? on_rgb[0] : 0;
+        pixel[2] = on? on_rgb[2] : 0;
+    }
+
+    // renders and sends a frame right away (without a frame rate); state_mutex must be held
+    void render_now()
+    {
+        auto start = std::chrono::steady_clock::now();
+        render::render_range(effects, bits.data(), on_rgb, std::chrono::duration_cast<std::chrono::milliseconds>(start.time_since_epoch()).count(), 0, pixels, grb[0].data());
+        draw_main(main_on, grb[0].data());
+        add_render_time(std::chrono::steady_clock::now() - start);
+        send(grb[0]);
+    }
+
+    void add_render_time(std::chrono::nanoseconds elapsed)
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        last_render = elapsed;
+        render_time += elapsed;
+        renders++;
+        max_render = std::max(max_render, elapsed);
+    }
+
+    void render_frames()
+    {
+        std::vector<uint64_t> frame_bits;
+        std::vector<render::Effect> frame_effects;
+        bool frame_main_on = false;
+        uint64_t t_ms = 0;
+        uint8_t* out = nullptr;
+        const render::WorkerPool::Job job = [&](size_t begin, size_t end) {
+            render::render_range(frame_effects, frame_bits.data(), on_rgb, t_ms, begin, end, out);
+        };
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / fps;
+        auto deadline = std::chrono::steady_clock::now();
+        bool animated = true;  // render the first frame
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                if (!animated && !state_changed) {
+                    state_changes.wait(lock, [this]() { return state_changed || stopping; });
+                    if (stopping) return;
+                    //else
+                    deadline = std::chrono::steady_clock::now();
+                }
+                if (state_changed) {
+                    frame_bits = bits;
+                    frame_effects = effects;
+                    frame_main_on = main_on;
+                    state_changed = false;
+                    animated = std::ranges::any_of(frame_effects, &render::Effect::is_animated);
+                }
+            }
+            auto start = std::chrono::steady_clock::now();
+            t_ms = std::chrono::duration_cast<std::chrono::milliseconds>(start.time_since_epoch()).count();
+            out = grb[back].data();
+            pool->run(pixels, grain, job);
+            draw_main(frame_main_on, out);
+            add_render_time(std::chrono::steady_clock::now() - start);
+            {
+                std::unique_lock<std::mutex> lock(handoff_mutex);
+                handoff.wait(lock, [this]() { return !pending || stop_requested; });
+                if (stop_requested) return;
+                //else
+                pending = true;
+                back ^= 1;
+            }
+            handoff.notify_all();
+            deadline += period;
+            auto now = std::chrono::steady_clock::now();
+            if (now > deadline) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                late_frames++;
+                deadline = now;
+            }
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+    // a failing thread stops both, leaving the strip as last sent
+    void stop_on_error(const std::exception& err)
+    {
+        std::cerr << "Strip output stopped: " << err.what() << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            error = err.what();
+        }
+        {
+            std::lock_guard<std::mutex> lock(handoff_mutex);
+            stop_requested = true;
+        }
+        handoff.notify_all();
+    }
+
+    void write_frames()
+    {
+        for (;;) {
+            unsigned front;
+            {
+                std::unique_lock<std::mutex> lock(handoff_mutex);
+                handoff.wait(lock, [this]() { return pending || stop_requested; });
+                if (stop_requested) return;
+                //else
+                front = back ^ 1;
+            }
+            send(grb[front]);
+            {
+                std::lock_guard<std::mutex> lock(handoff_mutex);
+                pending = false;
+            }
+            handoff.notify_all();
+        }
+    }
+public:
+    Ws2812Output(const std::string& _path, size_t _pixels, const std::array<uint8_t, 3>& rgb, unsigned int _fps, unsigned int threads)
+        : path(_path), pixels(_pixels), on_rgb(rgb), spi(ws2812::encoded_size(_pixels * 3)), bits((_pixels + 63) / 64, 0), fps(_fps)
+    {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) PERROR("open(" + path + ")");
+        struct stat st;
+        if (fstat(fd, &st) < 0) PERROR("fstat(" + path + ")");
+        spidev = S_ISCHR(st.st_mode);
+        if (spidev) {
+            uint8_t mode = SPI_MODE_0, bits_per_word = 8;
+            uint32_t speed = ws2812::spi_speed_hz;
+            if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) < 0
+                || ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+                close(fd);
+                PERROR("ioctl(" + path + ")");
+            }
+            // the transfers of one message share spidev's buffer, sized by its bufsiz module parameter
+            size_t bufsiz = 4096;
+            std::ifstream("/sys/module/spidev/parameters/bufsiz") >> bufsiz;
+            if (spi.size() > bufsiz || (spi.size() + max_transfer - 1) / max_transfer >= 512) {
+                close(fd);
+                throw std::runtime_error(path + ": a frame of " + std::to_string(spi.size()) + " bytes exceeds spidev's bufsiz of "
+                    + std::to_string(bufsiz) + " (raise it with spidev.bufsiz=N on the kernel command line)");
+            }
+            for (size_t offset = 0; offset < spi.size(); offset += max_transfer) {
+                struct spi_ioc_transfer transfer = {};
+                transfer.tx_buf = (uintptr_t)(spi.data() + offset);
+                transfer.len = std::min(max_transfer, spi.size() - offset);
+                transfer.speed_hz = ws2812::spi_speed_hz;
+                transfer.bits_per_word = 8;
+                transfers.push_back(transfer);
+            }
+        }
+        for (auto& buffer : grb) buffer.assign(pixels * 3, 0);
+        if (fps > 0) {
+            pool = std::make_unique<render::WorkerPool>(threads);
+            renderer = std::thread([this]() {
+                try {
+                    render_frames();
+                }
+                catch (const std::exception& err) {
+                    stop_on_error(err);
+                }
+            });
+            writer = std::thread([this]() {
+                try {
+                    write_frames();
+                }
+                catch (const std::exception& err) {
+                    stop_on_error(err);
+                }
+            });
+        }
+    }
+    ~Ws2812Output()
+    {
+        if (fps > 0) {
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                stopping = true;
+            }
+            state_changes.notify_all();
+            {
+                std::lock_guard<std::mutex> lock(handoff_mutex);
+                stop_requested = true;
+            }
+            handoff.notify_all();
+            renderer.join();
+            writer.join();
+            // leave the strip showing the final panel state without effects (all off at service exit)
+            if (error.empty()) {
+                render::render_range({}, bits.data(), on_rgb, 0, 0, pixels, grb[0].data());
+                draw_main(false, grb[0].data());
+                send(grb[0]);
+            }
+        }
+        close(fd);
+    }
+
+    void write(const uint64_t* _bits, size_t /*count*/) override
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        std::copy(_bits, _bits + bits.size(), bits.begin());
+        state_changed = true;
+        if (fps == 0) render_now();
+        else state_changes.notify_one();
+    }
+
+    // shows the main LED on the given pixel from now on (set_main() switches it)
+    void drive_main_led(size_t pixel)
+    {
+        if (pixel >= pixels) throw std::runtime_error("Main LED pixel " + std::to_string(pixel) + " is beyond the strip");
+        //else
+        std::lock_guard<std::mutex> lock(state_mutex);
+        main_pixel = pixel;
+    }
+
+    void set_main(bool on)
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if (!main_pixel || on == main_on) return;
+        //else
+        main_on = on;
+        state_changed = true;
+        if (fps == 0) render_now();
+        else state_changes.notify_one();
+    }
+
+    bool set_effect(size_t first, const std::string& spec) override
+    {
+        std::optional<render::Effect> effect;
+        if (!spec.empty()) {
+            effect = render::Effect::parse(first, spec);
+            if (!effect || first + effect->length > pixels) return false;
+        }
+        //else
+        std::lock_guard<std::mutex> lock(state_mutex);
+        std::erase_if(effects, [first](const render::Effect& e) { return e.first == first; });
+        if (effect) effects.push_back(std::move(*effect));
+        state_changed = true;
+        state_changes.notify_one();
+        return true;
+    }
+
+    std::optional<std::string> get_effect(size_t first) const override
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        for (const auto& effect : effects) {
+            if (effect.first == first) return effect.spec;
+        }
+        return std::nullopt;
+    }
+
+    void get_stats(std::map<std::string, std::string>& stats) const override
+    {
+        auto us = [](std::chrono::nanoseconds d) { return std::to_string(std::chrono::duration<double, std::micro>(d).count()); };
+        auto avg_us = [](std::chrono::nanoseconds total, uint64_t n) { return std::to_string(n? std::chrono::duration<double, std::micro>(total).count() / n : 0.0); };
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            stats["panel.effects"] = std::to_string(effects.size());
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats["panel.output"] = spidev? "ws2812 spidev" : "ws2812 file";
+        stats["panel.frames"] = std::to_string(frames);
+        stats["panel.render_us_avg"] = avg_us(render_time, renders);
+        stats["panel.render_us_max"] = us(max_render);
+        stats["panel.render_us_last"] = us(last_render);
+        stats["panel.encode_us_avg"] = avg_us(encode_time, frames);
+        stats["panel.encode_us_last"] = us(last_encode);
+        stats["panel.write_us_avg"] = avg_us(write_time, frames);
+        stats["panel.write_us_last"] = us(last_write);
+        if (pool) {
+            stats["panel.fps"] = std::to_string(fps);
+            stats["panel.late_frames"] = std::to_string(late_frames);
+            stats["panel.render_threads"] = std::to_string(pool->size());
+            stats["panel.render_steals"] = std::to_string(pool->get_steals());
+        }
+        if (!error.empty()) stats["panel.error"] = error;
+    }
+};
+
+frame::Timeline panel;
+std::unique_ptr<PanelOutput> panel_output;
+bool panel_dirty = false;
+
+// With --panel-tick the panel is evaluated on a fixed tick instead of at its edges: every tick the packed
+// evaluator computes all LEDs at once, and the bitmask goes to the output when it differs from the one last
+// written.  The timeline still holds the patterns (for get) but no longer drives the output.
+frame::Evaluator panel_frame;
+std::vector<uint64_t> panel_frame_bits, panel_written_bits;
+std::chrono::steady_clock::time_point next_panel_tick;
+
+uint64_t get_panel_time_ms(std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now())
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+}
+
+// panel LEDs accept on, off, blink and blink=HALF_PERIOD_MS
+std::optional<frame::Pattern> parse_panel_action(const std::string& action)
+{
+    if (action == "on") return frame::Pattern::on();
+    if (action == "off") return frame::Pattern::off();
+    if (auto half_period = match_action(action, "blink")) {
+        if (half_period->empty()) return frame::Pattern::blink(blink_interval.count());
+        //else
+        uint32_t ms;
+        auto [ptr, ec] = std::from_chars(half_period->data(), half_period->data() + half_period->size(), ms);
+        if (ec == std::errc() && ptr == half_period->data() + half_period->size() && ms > 0) return frame::Pattern::blink(ms);
+    }
+    //else
+    return std::nullopt;
+}
+
+std::string format_panel_action(const frame::Pattern& pattern)
+{
+    if (pattern.period_ms == 0) return pattern.on_ms > 0? "on" : "off";
+    if (pattern.on_ms == blink_interval.count() && pattern.period_ms == 2 * pattern.on_ms) return "blink";
+    //else
+    return "blink=" + std::to_string(pattern.on_ms);
 }
 
-const std::string progname = "led-indicator";
+void set_panel_pattern(size_t index, const frame::Pattern& pattern)
+{
+    if (panel.set(index, pattern, get_panel_time_ms())) panel_dirty = true;
+    panel_frame.set(index, pattern);
+    if (panel_tick_ms > 0) panel_dirty = true;  // the evaluator does not tell; let the next write decide
+}
 
-std::string serviceName = defaults::serviceName;
-std::string objectPath = defaults::objectPath;
-std::string interfaceName = defaults::interfaceName;
+void add_panel_led()
+{
+    panel.add(frame::Pattern::off(), get_panel_time_ms());
+    panel_frame.add(frame::Pattern::off());
+    panel_frame_bits.resize(panel_frame.words());
+}
 
-enum led_action_t { LED_ON, LED_OFF, LED_BLINK };
+// writes whatever is due: the timeline's edges within the next millisecond together, or on a tick (and
+// right after a change) the evaluated frame if it differs from the last one written
+void update_panel(std::chrono::steady_clock::time_point now)
+{
+    if (panel_tick_ms == 0) {
+        if (panel.advance(get_panel_time_ms(now), 1) > 0 || panel_dirty) {
+            panel_output->write(panel.get_bits(), panel.size());
+            panel_dirty = false;
+        }
+        return;
+    }
+    //else
+    if (now < next_panel_tick && !panel_dirty) return;
+    //else
+    panel_frame.evaluate((uint32_t)get_panel_time_ms(now), panel_frame_bits.data());
+    if (panel_dirty || panel_frame_bits != panel_written_bits) {
+        panel_output->write(panel_frame_bits.data(), panel_frame.size());
+        panel_written_bits = panel_frame_bits;
+        panel_dirty = false;
+    }
+    if (now >= next_panel_tick) next_panel_tick = std::max(next_panel_tick + std::chrono::milliseconds(panel_tick_ms), now);
+}
 
-led_action_t led_action = LED_OFF;
+std::chrono::steady_clock::time_point next_panel_deadline()
+{
+    if (!panel_output) return std::chrono::steady_clock::time_point::max();
+    if (panel_tick_ms > 0) return next_panel_tick;
+    if (panel.next_deadline() == UINT64_MAX) return std::chrono::steady_clock::time_point::max();
+    //else
+    return std::chrono::steady_clock::time_point(std::chrono::milliseconds(panel.next_deadline()));
+}
 
-#define PERROR(s) throw std::runtime_error(std::string(s) + ": " + std::strerror(errno))
+// a plain action on an LED also clears any effect starting there; anything else is tried as an effect
+bool apply_panel_led(uint32_t index, const std::string& action)
+{
+    if (index >= panel.size()) return false;
+    //else
+    auto pattern = parse_panel_action(action);
+    if (!pattern) {
+        if (!panel_output->set_effect(index, action)) return false;
+        //else
+        panel_dirty = true;
+        return true;
+    }
+    //else
+    panel_output->set_effect(index, "");
+    set_panel_pattern(index, *pattern);
+    return true;
+}
 
-bool get_expected_led_state(int blink_interval_ms = 500) {
-    if (led_action == LED_ON) return true;
-    if (led_action == LED_OFF) return false;
+bool set_panel_led(uint32_t index, const std::string& action)
+{
+    if (!apply_panel_led(index, action)) return false;
     //else
-    return (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() / blink_interval_ms) % 2 == 0;
+    state_version++;
+    return true;
 }
 
-auto create_signalfd(const std::vector<int>& signals = {SIGINT, SIGTERM})
+// panel LED by name (service --panel-names) or index
+std::optional<uint32_t> find_panel_led(const std::string& name)
 {
-    sigset_t mask;
-    sigemptyset(&mask);
-    for (auto signal : signals) {
-        sigaddset(&mask, signal);
+    if (auto i = std::find(panel_names.begin(), panel_names.end(), name); i != panel_names.end()) return i - panel_names.begin();
+    //else
+    uint32_t index;
+    auto [ptr, ec] = std::from_chars(name.data(), name.data() + name.size(), index);
+    if (ec == std::errc() && ptr == name.data() + name.size() && index < panel.size()) return index;
+    //else
+    return std::nullopt;
+}
+
+// Sets several panel LEDs as one change: either all actions are taken or none.  Plain patterns cannot
+// fail, but an effect can be refused by the output, so the LEDs touched so far are then put back.  Since
+// the loop writes the panel once after handling requests, the LEDs change together in a single write.
+bool set_panel_leds(const std::vector<std::pair<uint32_t, std::string>>& actions)
+{
+    std::vector<std::tuple<uint32_t, frame::Pattern, std::optional<std::string>>> saved;
+    for (const auto& [index, action] : actions) {
+        if (index >= panel.size()) return false;
+        //else
+        saved.emplace_back(index, panel.get(index), panel_output->get_effect(index));
     }
-    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) PERROR("sigprocmask");
-    int sfd = signalfd(-1, &mask, 0);
-    if (sfd < 0) PERROR("signalfd");
+    for (const auto& [index, action] : actions) {
+        if (apply_panel_led(index, action)) continue;
+        //else
+        for (auto i = saved.rbegin(); i != saved.rend(); i++) {
+            const auto& [index, pattern, effect] = *i;
+            set_panel_pattern(index, pattern);
+            panel_output->set_effect(index, effect.value_or(""));
+        }
+        panel_dirty = true;
+        return false;
+    }
+    state_version++;
+    return true;
+}
+
+std::string get_panel_led(uint32_t index)
+{
+    if (auto effect = panel_output->get_effect(index)) return *effect;
     //else
-    return sfd;
+    return format_panel_action(panel.get(index));
 }
 
-int service(const std::string& chipname, unsigned int line_num)
+std::unique_ptr<varlink::Server> varlink_server;
+
+std::map<std::string, std::string> get_stats()
+{
+    std::map<std::string, std::string> stats;
+    stats["action"] = get_led_action();
+    if (dynamic_action) dynamic_action->get_stats(stats);
+    if (trigger_fifo) trigger_fifo->get_stats(stats);
+    for (const auto& button : buttons) button->get_stats(stats);
+    if (phase_lock) phase_lock->get_stats(stats);
+    if (rgb_output) rgb_output->get_stats(stats);
+    if (pwm_output) {
+        pwm_output->get_stats(stats);
+        if (main_plan.backend == "pwm") stats["pwm.mode"] = main_plan.method;
+    }
+    if (led_class_output) led_class_output->get_stats(stats);
+    if (varlink_server) {
+        stats["varlink.clients"] = std::to_string(varlink_server->get_clients());
+        stats["varlink.watchers"] = std::to_string(varlink_server->get_watchers());
+        stats["varlink.connections"] = std::to_string(varlink_server->get_connections());
+        stats["varlink.calls"] = std::to_string(varlink_server->get_calls());
+    }
+    stats["state.version"] = std::to_string(state_version);
+    stats["wait.pending"] = std::to_string(change_waiters.size());
+    stats["wait.calls"] = std::to_string(change_waits);
+    stats["plan.backend"] = main_plan.backend;
+    stats["plan.method"] = main_plan.method;
+    stats["plan.timing"] = main_plan.userspace? "userspace" : "offloaded";
+    // a program's step rate is observed as it runs, after the plan was made
+    stats["plan.wakeups_per_s_estimate"] = std::to_string(main_plan.userspace? get_userspace_wakeups_per_second() : main_plan.wakeups_per_second);
+    auto plan_elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - main_plan_since).count();
+    stats["loop.wakeups"] = std::to_string(loop_wakeups);
+    stats["loop.wakeups_per_s"] = std::to_string(plan_elapsed > 0? (loop_wakeups - main_plan_wakeups) / plan_elapsed : 0.0);
+    if (panel_output) {
+        stats["panel.leds"] = std::to_string(panel.size());
+        stats["panel.evaluation"] = panel_tick_ms > 0? "tick " + std::to_string(panel_tick_ms) + "ms" : "edges";
+        stats["panel.edges"] = std::to_string(panel.get_edges());
+        stats["panel.wakeups"] = std::to_string(panel.get_wakeups());
+        panel_output->get_stats(stats);
+    }
+    if (scheduler.size() > 0) {
+        stats["sequencer.tasks"] = std::to_string(scheduler.size());
+        stats["sequencer.resumes"] = std::to_string(scheduler.get_resumes());
+    }
+    return stats;
+}
+
+#ifndef NO_DBUS
+std::unique_ptr<sdbus::IObject> create_dbus_object(sdbus::IConnection& connection)
 {
-    std::cout << "Registering D-Bus service: " << serviceName << " at " << objectPath << " with interface: " << interfaceName << std::endl;
-    auto connection = sdbus::createSystemBusConnection();
-    auto object = sdbus::createObject(*connection, objectPath);
+    auto object = sdbus::createObject(connection, objectPath);
     object->registerMethod("set")
         .onInterface(interfaceName)
         .implementedAs([](const std::string& action) {
-            if (action == "on") {
-                led_action = LED_ON;
-                return true;
-            }
-            else if (action == "off") {
-                led_action = LED_OFF;
-                return true;
+            return set_led_action(action);
+        });
+    object->registerMethod("get")
+        .onInterface(interfaceName)
+        .implementedAs([]() {
+            return get_led_action();
+        });
+    object->registerMethod("getState")
+        .onInterface(interfaceName)
+        .implementedAs([]() {
+            return std::make_tuple(get_led_action(), state_version);
+        });
+    object->registerMethod("setIf")
+        .onInterface(interfaceName)
+        .implementedAs([](uint64_t expected_version, const std::string& action) {
+            bool success = set_led_action_if(expected_version, action);
+            return std::make_tuple(success, state_version);
+        });
+    object->registerMethod("setIfState")
+        .onInterface(interfaceName)
+        .implementedAs([](const std::string& expected_action, const std::string& action) {
+            bool success = set_led_action_if_state(expected_action, action);
+            return std::make_tuple(success, state_version);
+        });
+    object->registerMethod("waitChange")
+        .onInterface(interfaceName)
+        .implementedAs([](sdbus::Result<std::string, uint64_t>&& result, uint64_t last_version, uint32_t timeout_ms) {
+            if (state_version != last_version) {
+                result.returnResults(get_led_action(), state_version);
+                return;
             }
-            else if (action == "blink") {
-                led_action = LED_BLINK;
-                return true;
+            //else
+            add_change_waiter(last_version, timeout_ms, [result = std::move(result)]() {
+                result.returnResults(get_led_action(), state_version);
+            });
+        });
+    object->registerMethod("setLed")
+        .onInterface(interfaceName)
+        .implementedAs([](uint32_t index, const std::string& action) {
+            return set_panel_led(index, action);
+        });
+    object->registerMethod("setMany")
+        .onInterface(interfaceName)
+        .implementedAs([](const std::map<std::string, std::string>& leds) {
+            std::vector<std::pair<uint32_t, std::string>> actions;
+            for (const auto& [name, action] : leds) {
+                auto index = find_panel_led(name);
+                if (!index) throw sdbus::Error(interfaceName + ".Error.NoSuchLed", "No such LED: " + name);
+                //else
+                actions.emplace_back(*index, action);
             }
-            else return false;
+            return set_panel_leds(actions);
         });
-    object->registerMethod("get")
+    object->registerMethod("getLed")
+        .onInterface(interfaceName)
+        .implementedAs([](uint32_t index) {
+            if (index >= panel.size()) throw sdbus::Error(interfaceName + ".Error.NoSuchLed", "No such LED: " + std::to_string(index));
+            //else
+            return get_panel_led(index);
+        });
+    object->registerMethod("stats")
         .onInterface(interfaceName)
         .implementedAs([]() {
-            return std::string(led_action == LED_ON? "on" : led_action == LED_OFF? "off" : "blink");
+            return get_stats();
+        });
+    object->registerMethod("loadProgram")
+        .onInterface(interfaceName)
+        .implementedAs([](const std::string& source) {
+            try {
+                dynamic_action = std::make_unique<LedProgram>(source);
+            }
+            catch (const std::runtime_error& err) {
+                throw sdbus::Error(interfaceName + ".Error.InvalidProgram", err.what());
+            }
+            led_action = LED_DYNAMIC;
+            state_version++;
+            return true;
         });
+    object->registerSignal("buttonPressed")
+        .onInterface(interfaceName)
+        .withParameters<uint32_t, std::string>();
     object->finishRegistration();
-    connection->requestName(serviceName);
-    std::cout << "Service registered" << std::endl;
+    return object;
+}
+#endif
+
+// Varlink counterpart of the D-Bus methods, plus Watch, which streams the main LED's action whenever it
+// changes (the call must set "more")
+void handle_varlink_call(varlink::Server::Client& client, const varlink::Call& call)
+{
+    auto invalid_parameter = [&](const std::string& name) {
+        client.error("org.varlink.service.InvalidParameter", "{\"parameter\":" + json::quote(name) + "}");
+    };
+    auto uint_parameter = [&](const std::string& name, uint64_t max) -> std::optional<uint64_t> {
+        auto value = call.parameters.get(name);
+        auto number = value? value->as_uint(max) : std::nullopt;
+        if (!number) invalid_parameter(name);
+        return number;
+    };
+    // the optional panel LED index; false when it was given but invalid (and has been answered)
+    auto led_parameter = [&](std::optional<uint32_t>& led) {
+        if (!call.parameters.get("led")) return true;
+        //else
+        auto index = uint_parameter("led", UINT32_MAX);
+        if (index) led = *index;
+        return index.has_value();
+    };
+    auto no_such_led = [&](uint32_t index) {
+        client.error(interfaceName + ".NoSuchLed", "{\"led\":" + std::to_string(index) + "}");
+    };
+    auto reply_success = [&](bool success) {
+        client.reply(std::string("{\"success\":") + (success? "true" : "false") + ",\"version\":" + std::to_string(state_version) + "}");
+    };
+    auto string_parameter = [&](const std::string& name) -> std::optional<std::string> {
+        auto value = call.parameters.get(name);
+        if (!value || value->type != json::Value::STRING) {
+            invalid_parameter(name);
+            return std::nullopt;
+        }
+        //else
+        return value->string;
+    };
+    if (call.method == interfaceName + ".Set") {
+        auto action = string_parameter("action");
+        if (!action) return;
+        //else
+        std::optional<uint32_t> led;
+        if (!led_parameter(led)) return;
+        //else
+        if (led && *led >= panel.size()) {
+            no_such_led(*led);
+            return;
+        }
+        //else
+        reply_success(led? set_panel_led(*led, *action) : set_led_action(*action));
+    } else if (call.method == interfaceName + ".SetIf") {
+        auto expected_version = uint_parameter("expected_version", UINT64_MAX);
+        if (!expected_version) return;
+        //else
+        auto action = string_parameter("action");
+        if (!action) return;
+        //else
+        reply_success(set_led_action_if(*expected_version, *action));
+    } else if (call.method == interfaceName + ".SetIfState") {
+        auto expected_action = string_parameter("expected_action");
+        if (!expected_action) return;
+        //else
+        auto action = string_parameter("action");
+        if (!action) return;
+        //else
+        reply_success(set_led_action_if_state(*expected_action, *action));
+    } else if (call.method == interfaceName + ".SetMany") {
+        auto leds = call.parameters.get("leds");
+        if (!leds || leds->type != json::Value::OBJECT) {
+            client.error("org.varlink.service.InvalidParameter", "{\"parameter\":\"leds\"}");
+            return;
+        }
+        //else
+        std::vector<std::pair<uint32_t, std::string>> actions;
+        for (const auto& [name, action] : leds->object) {
+            if (action.type != json::Value::STRING) {
+                client.error("org.varlink.service.InvalidParameter", "{\"parameter\":\"leds\"}");
+                return;
+            }
+            //else
+            auto index = find_panel_led(name);
+            if (!index) {
+                client.error(interfaceName + ".NoSuchLedName", "{\"name\":" + json::quote(name) + "}");
+                return;
+            }
+            //else
+            actions.emplace_back(*index, action.string);
+        }
+        reply_success(set_panel_leds(actions));
+    } else if (call.method == interfaceName + ".Get") {
+        std::optional<uint32_t> led;
+        if (!led_parameter(led)) return;
+        //else
+        if (led && *led >= panel.size()) {
+            no_such_led(*led);
+            return;
+        }
+        //else
+        client.reply("{\"action\":" + json::quote(led? get_panel_led(*led) : get_led_action()) + ",\"version\":" + std::to_string(state_version) + "}");
+    } else if (call.method == interfaceName + ".Watch") {
+        if (!call.more) {
+            client.error("org.varlink.service.ExpectedMore");
+            return;
+        }
+        //else
+        client.reply("{\"action\":" + json::quote(get_led_action()) + ",\"version\":" + std::to_string(state_version) + "}", true);
+        client.watching = true;
+    } else if (call.method == interfaceName + ".WaitChange") {
+        auto last_version = uint_parameter("last_version", UINT64_MAX);
+        if (!last_version) return;
+        //else
+        std::optional<uint64_t> timeout_ms = 0;
+        if (call.parameters.get("timeout_ms")) timeout_ms = uint_parameter("timeout_ms", UINT32_MAX);
+        if (!timeout_ms) return;
+        //else
+        auto state = []() { return "{\"action\":" + json::quote(get_led_action()) + ",\"version\":" + std::to_string(state_version) + "}"; };
+        if (state_version != *last_version) {
+            client.reply(state());
+            return;
+        }
+        //else
+        client.deferred = true;
+        add_change_waiter(*last_version, *timeout_ms, [id = client.get_id(), state]() {
+            varlink_server->deferred_reply(id, state());
+        }, client.get_id());
+    } else if (call.method == interfaceName + ".LoadProgram") {
+        auto source = string_parameter("source");
+        if (!source) return;
+        //else
+        try {
+            dynamic_action = std::make_unique<LedProgram>(*source);
+        }
+        catch (const std::runtime_error& err) {
+            client.error(interfaceName + ".InvalidProgram", "{\"reason\":" + json::quote(err.what()) + "}");
+            return;
+        }
+        led_action = LED_DYNAMIC;
+        state_version++;
+        reply_success(true);
+    } else if (call.method == interfaceName + ".Stats") {
+        std::string stats_json;
+        for (const auto& [key, value] : get_stats()) stats_json += (stats_json.empty()? "" : ",") + json::quote(key) + ":" + json::quote(value);
+        client.reply("{\"stats\":{" + stats_json + "}}");
+    } else if (call.method == "org.varlink.service.GetInfo") {
+        client.reply("{\"vendor\":\"Walbrix Corporation\",\"product\":\"" + progname + "\",\"version\":\"\",\"url\":\"https://github.com/shimarin/led-indicator\","
+            "\"interfaces\":[\"org.varlink.service\"," + json::quote(interfaceName) + "]}");
+    } else if (call.method == "org.varlink.service.GetInterfaceDescription") {
+        auto name = call.parameters.get("interface");
+        if (!name || name->type != json::Value::STRING || name->string != interfaceName) {
+            client.error("org.varlink.service.InterfaceNotFound", "{\"interface\":" + json::quote(name && name->type == json::Value::STRING? name->string : "") + "}");
+            return;
+        }
+        //else
+        client.reply("{\"description\":" + json::quote("interface " + interfaceName + "\n\n"
+            "method Set(action: string, led: ?int) -> (success: bool, version: int)\n"
+            "method SetIf(expected_version: int, action: string) -> (success: bool, version: int)\n"
+            "method SetIfState(expected_action: string, action: string) -> (success: bool, version: int)\n"
+            "method SetMany(leds: [string]string) -> (success: bool, version: int)\n"
+            "method Get(led: ?int) -> (action: string, version: int)\n"
+            "method Watch() -> (action: string, version: int)\n"
+            "method WaitChange(last_version: int, timeout_ms: ?int) -> (action: string, version: int)\n"
+            "method LoadProgram(source: string) -> (success: bool, version: int)\n"
+            "method Stats() -> (stats: [string]string)\n"
+            "error NoSuchLed(led: int)\n"
+            "error NoSuchLedName(name: string)\n"
+            "error InvalidProgram(reason: string)\n") + "}");
+    } else {
+        client.error("org.varlink.service.MethodNotFound", "{\"method\":" + json::quote(call.method) + "}");
+    }
+}
+
+auto create_signalfd(const std::vector<int>& signals = {SIGINT, SIGTERM})
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (auto signal : signals) {
+        sigaddset(&mask, signal);
+    }
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) PERROR("sigprocmask");
+    int sfd = signalfd(-1, &mask, 0);
+    if (sfd < 0) PERROR("signalfd");
+    //else
+    return sfd;
+}
+
+int service(const std::string& chipname, unsigned int line_num)
+{
+#ifndef NO_DBUS
+    std::unique_ptr<sdbus::IConnection> connection;
+    std::unique_ptr<sdbus::IObject> object;
+    if (use_dbus) {
+        std::cout << "Registering D-Bus service: " << serviceName << " at " << objectPath << " with interface: " << interfaceName << std::endl;
+        connection = sdbus::createSystemBusConnection();
+        bus_connection = connection.get();
+        object = create_dbus_object(*connection);
+        connection->requestName(serviceName);
+        std::cout << "Service registered" << std::endl;
+    }
+#endif
+    if (use_varlink) {
+        varlink_server = std::make_unique<varlink::Server>(varlink_socket, handle_varlink_call);
+        varlink_server->on_close(drop_change_waiters);
+        std::cout << "Varlink interface " << interfaceName << " at " << varlink_socket << std::endl;
+    }
+    if (!use_dbus && !varlink_server) throw std::runtime_error("--no-dbus requires --varlink");
 
     gpiod::chip chip(chipname);
-    gpiod::line line = chip.get_line(line_num);
-    line.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT}, 0);
-    line.set_value(0);
+    gpiod::line line;
+    if (!led_class_name.empty()) {
+        led_class_output = std::make_unique<LedClassOutput>(leds_root, led_class_name);
+        std::cout << "Main LED as kernel LED " << led_class_output->get_path() << " (max brightness " << led_class_output->get_max_brightness() << ", triggers:";
+        for (const auto& trigger : led_class_output->get_triggers()) std::cout << " " << trigger;
+        std::cout << ")" << std::endl;
+    }
+    if (pwm_channel) {
+        pwm_output = std::make_unique<PwmOutput>(pwm_root, pwm_channel->first, pwm_channel->second);
+        std::cout << "Main LED on PWM channel " << pwm_output->get_path() << " (hardware blink " << (pwm_output->can_blink()? "supported" : "unsupported") << ")" << std::endl;
+    }
+    // without another backend an RGB LED or the strip is the main LED
+    bool strip_is_main = !led_class_output && !pwm_output && rgb_line_nums.empty() && !strip_device.empty();
+    if (!led_class_output && !pwm_output && rgb_line_nums.empty() && !strip_is_main) {
+        line = chip.get_line(line_num);
+        line.request({"led-indicator", gpiod::line_request::DIRECTION_OUTPUT}, 0);
+        line.set_value(0);
+    }
+
+    for (const auto& spec : button_specs) {
+        buttons.push_back(std::make_unique<Button>(chip, spec));
+        std::cout << "Button on line " << buttons.back()->get_line_num() << ": " << buttons.back()->get_action() << std::endl;
+    }
+
+    if (!panel_line_nums.empty() + !shift_register_line_nums.empty() + !matrix_row_line_nums.empty() + !strip_device.empty() > 1) {
+        throw std::runtime_error("--panel-lines, --shift-register, --matrix-rows and --strip-device are exclusive");
+    }
+    if (!panel_line_nums.empty()) {
+        panel_output = std::make_unique<GpioPanelOutput>(chip, panel_line_nums);
+        panel_size = panel_line_nums.size();
+        std::cout << "Panel of " << panel_size << " LEDs on GPIO lines" << std::endl;
+    }
+    if (!shift_register_line_nums.empty()) {
+        if (panel_size == 0) throw std::runtime_error("--shift-register requires --panel-size");
+        panel_output = std::make_unique<ShiftRegisterOutput>(chip, shift_register_line_nums);
+        std::cout << "Panel of " << panel_size << " LEDs on 74HC595 shift registers" << std::endl;
+    }
+    if (!matrix_row_line_nums.empty()) {
+        auto matrix = std::make_unique<MatrixOutput>(chip, matrix_row_line_nums, matrix_col_line_nums, matrix_refresh_hz);
+        panel_size = matrix->size();
+        panel_output = std::move(matrix);
+        std::cout << "Panel of " << panel_size << " LEDs on a " << matrix_row_line_nums.size() << "x" << matrix_col_line_nums.size() << " matrix" << std::endl;
+    }
+    if (!strip_device.empty()) {
+        auto color = render::parse_color(strip_color);
+        if (!color) throw std::runtime_error("Invalid colour: " + strip_color);
+        if (strip_length == 0) throw std::runtime_error("--strip-device requires --strip-length");
+        //else
+        auto strip = std::make_unique<Ws2812Output>(strip_device, strip_length, *color, strip_fps, strip_threads);
+        if (strip_is_main) {
+            strip->drive_main_led(strip_main_pixel);
+            main_strip = strip.get();
+        }
+        panel_output = std::move(strip);
+        panel_size = strip_length;
+        std::cout << "Panel of " << panel_size << " WS2812 pixels on " << strip_device;
+        if (strip_fps > 0) std::cout << ", rendered at " << strip_fps << "fps on " << strip_threads << " threads";
+        if (main_strip) std::cout << ", main LED on pixel " << strip_main_pixel;
+        std::cout << std::endl;
+    }
+    for (size_t i = 0; panel_output && i < panel_size; i++) add_panel_led();
+    if (panel_output) panel_output->write(panel.get_bits(), panel.size());
+    if (panel_names.size() > panel.size()) throw std::runtime_error("--panel-names names more LEDs than the panel has");
+
+    if (!rgb_line_nums.empty()) {
+        std::vector<double> gammas;
+        for (auto gamma = std::string_view(rgb_gamma); !gamma.empty(); ) {
+            auto comma = gamma.find(',');
+            gammas.push_back(to_double(gamma.substr(0, comma)));
+            gamma = comma == std::string_view::npos? std::string_view() : gamma.substr(comma + 1);
+        }
+        rgb_output = std::make_unique<RgbOutput>(chip, rgb_line_nums, rgb_common_cathode, gammas, rgb_pwm_hz, rgb_bits, rgb_dither);
+        std::cout << "RGB LED on lines " << rgb_line_nums[0] << "," << rgb_line_nums[1] << "," << rgb_line_nums[2]
+            << ": " << rgb_pwm_hz << "Hz PWM, " << rgb_bits << " bits" << (rgb_dither? " with dithering" : "") << std::endl;
+    }
+
+    if (sync_line_num) {
+        phase_lock = std::make_unique<PhaseLock>(chip, *sync_line_num, sync_period);
+        std::cout << "Blink phase follows reference pulses on line " << *sync_line_num << std::endl;
+    }
 
     auto sigfd = create_signalfd();
 
+    if (!trigger_fifo_path.empty()) {
+        trigger_fifo = std::make_unique<TriggerFifo>(trigger_fifo_path);
+        flash_overlay.start(scheduler);
+        std::cout << "Accepting trigger commands at " << trigger_fifo_path << std::endl;
+    }
+
     bool exit_requested = false;
+    auto watched_version = state_version;
 
     while (!exit_requested) {
-        struct pollfd fds[2];
-        fds[0].fd = connection->getEventLoopPollData().fd;
+        std::vector<pollfd> fds(1);
+        fds[0].fd = sigfd;
         fds[0].events = POLLIN;
-        fds[1].fd = sigfd;
-        fds[1].events = POLLIN;
-        if (poll(fds, 2, 100) < 0) PERROR("poll");
+        // sd-bus tells what to wait for: POLLOUT while output is queued, and a deadline of its own
+        // (absolute CLOCK_MONOTONIC microseconds, UINT64_MAX for none) for method call timeouts etc.
+        auto dbus_deadline = std::chrono::steady_clock::time_point::max();
+#ifndef NO_DBUS
+        if (connection) {
+            auto poll_data = connection->getEventLoopPollData();
+            fds.push_back({poll_data.fd, (short)poll_data.events, 0});
+            if (poll_data.timeout_usec != UINT64_MAX) dbus_deadline = std::chrono::steady_clock::time_point(std::chrono::microseconds(poll_data.timeout_usec));
+        }
+#endif
+        auto varlink_fds_begin = fds.size();
+        if (varlink_server) varlink_server->add_poll_fds(fds);
+        auto varlink_fds_end = fds.size();
+        auto fifo_fd_index = fds.size();
+        if (trigger_fifo) fds.push_back({trigger_fifo->get_fd(), POLLIN, 0});
+        auto button_fds_begin = fds.size();
+        for (const auto& button : buttons) fds.push_back({button->get_fd(), POLLIN, 0});
+        auto sync_fd_index = fds.size();
+        if (phase_lock) fds.push_back({phase_lock->get_fd(), POLLIN, 0});
+        auto dynamic_fds_begin = fds.size();
+        if (dynamic_action && !is_main_led_offloaded()) dynamic_action->add_poll_fds(fds);
+
+        // sleep with nanosecond resolution until the next LED edge; nothing to do in between
+        auto led_deadline = is_main_led_offloaded()? std::chrono::steady_clock::time_point::max() : get_next_led_deadline();
+        auto deadline = std::min({led_deadline, scheduler.next_deadline(), next_change_waiter_deadline(), dbus_deadline, next_panel_deadline(), next_button_deadline()});
+        struct timespec timeout;
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            auto remaining = std::max(deadline - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+            timeout.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(remaining).count();
+            timeout.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining % std::chrono::seconds(1)).count();
+        }
+        if (ppoll(fds.data(), fds.size(), deadline != std::chrono::steady_clock::time_point::max()? &timeout : nullptr, nullptr) < 0) PERROR("ppoll");
         //else
+        loop_wakeups++;
+
+        if (fds[0].revents & POLLIN) exit_requested = true;
 
-        if (fds[1].revents & POLLIN) exit_requested = true;
+        // dispatch before processing D-Bus requests or FIFO commands, which may replace the action owning these fds
+        for (size_t i = dynamic_fds_begin; i < fds.size(); i++) {
+            if (fds[i].revents) dynamic_action->handle_poll_event(fds[i]);
+        }
+        if (trigger_fifo && fds[fifo_fd_index].revents & POLLIN) trigger_fifo->handle_poll_event();
+        if (phase_lock && fds[sync_fd_index].revents & POLLIN) phase_lock->handle_poll_event();
+        for (size_t i = 0; i < buttons.size(); i++) {
+            auto& button = *buttons[i];
+            int new_presses = (fds[button_fds_begin + i].revents & POLLIN)? button.handle_poll_event() : 0;
+            new_presses += button.settle(std::chrono::steady_clock::now());
+            for (int n = new_presses; n > 0; n--) {
+                apply_button_action(button.get_action());
+#ifndef NO_DBUS
+                if (object) object->emitSignal("buttonPressed").onInterface(interfaceName).withArguments(button.get_line_num(), button.get_action());
+#endif
+            }
+        }
 
-        while(connection->processPendingRequest()) {
+#ifndef NO_DBUS
+        while(connection && connection->processPendingRequest()) {
             ;
         }
-        auto expected_led_state = get_expected_led_state();
-        if (line.get_value() != expected_led_state) {
-            line.set_value(expected_led_state);
+#endif
+        for (size_t i = varlink_fds_begin; i < varlink_fds_end; i++) {
+            if (fds[i].revents) varlink_server->handle_poll_event(fds[i]);
+        }
+        auto now = std::chrono::steady_clock::now();
+        scheduler.run_due(now);
+        if (panel_output) update_panel(now);
+        if (dynamic_action && !is_main_led_offloaded()) dynamic_action->update(now);
+        auto expected_led_state = get_expected_led_state() != flash_overlay.get_led_state();
+        auto plan_inputs = std::make_tuple(state_version, flash_overlay.is_idle(), phase_lock && phase_lock->is_active());
+        if (plan_inputs != main_plan_inputs) {
+            main_plan_inputs = plan_inputs;
+            if (auto plan = plan_main_led(); plan != main_plan) {
+                // the backend given up (when several reach the LED) goes dark
+                if (plan.backend != main_plan.backend && main_plan.backend == "led-class") led_class_output->set_level(0.0);
+                if (plan.backend != main_plan.backend && main_plan.backend == "pwm") pwm_output->set_level(0.0);
+                main_plan = plan;
+                main_plan_since = now;
+                main_plan_wakeups = loop_wakeups;
+            }
+        }
+        apply_main_led_plan(line, expected_led_state);
+        if (rgb_output) rgb_output->set(expected_led_state? led_colors.on : led_colors.off);
+        if (main_strip) main_strip->set_main(expected_led_state);
+        if (varlink_server) {
+            if (state_version != watched_version) {
+                varlink_server->notify_watchers("{\"action\":" + json::quote(get_led_action()) + ",\"version\":" + std::to_string(state_version) + "}");
+                watched_version = state_version;
+            }
         }
+        answer_change_waiters(now);
     }
 
+    trigger_fifo.reset();
+    buttons.clear();
+    phase_lock.reset();
+    rgb_output.reset();
+    if (panel_output) {
+        for (size_t i = 0; i < panel.size(); i++) set_panel_pattern(i, frame::Pattern::off());
+        panel_output->write(panel.get_bits(), panel.size());
+        main_strip = nullptr;
+        panel_output.reset();
+    }
     close(sigfd);
 
-    line.set_value(0);
-    line.release();
+    pwm_output.reset();
+    led_class_output.reset();
+    if (line) {
+        line.set_value(0);
+        line.release();
+    }
 
-    connection->releaseName(serviceName);
+    answer_change_waiters(std::chrono::steady_clock::time_point::max());  // nobody is left waiting for an exited service
+    varlink_server.reset();
+#ifndef NO_DBUS
+    if (connection) connection->releaseName(serviceName);
+#endif
     std::cout << "Exit." << std::endl;
     return EXIT_SUCCESS;
 }
 
-int set(const std::string& action)
+// parameters of a Varlink call: {"name":value,...} from already encoded values
+std::string varlink_parameters(std::initializer_list<std::pair<std::string, std::string>> parameters)
+{
+    std::string json;
+    for (const auto& [name, value] : parameters) json += (json.empty()? "" : ",") + json::quote(name) + ":" + value;
+    return "{" + json + "}";
+}
+
+int set(const std::string& action, std::optional<uint32_t> led = std::nullopt)
+{
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        bool result;
+        if (led) proxy->callMethod("setLed").onInterface(interfaceName).withArguments(*led, action).storeResultsTo(result);
+        else proxy->callMethod("set").onInterface(interfaceName).withArguments(action).storeResultsTo(result);
+        std::cout << (result? "success" : "error") << std::endl;
+        return result? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    //else
+#endif
+    varlink::Client client(varlink_socket);
+    auto reply = led? client.call(interfaceName + ".Set", varlink_parameters({{"action", json::quote(action)}, {"led", std::to_string(*led)}}))
+        : client.call(interfaceName + ".Set", varlink_parameters({{"action", json::quote(action)}}));
+    auto success = reply.get("success");
+    bool result = success && success->type == json::Value::BOOL && success->boolean;
+    std::cout << (result? "success" : "error") << std::endl;
+    return result? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// NAME=ACTION of `set` with several LEDs; NAME is a panel LED name or index.  Action keywords taking a
+// parameter after "=" (blink=MS, effects) and actions of the form kind:...=... are not assignments.
+std::optional<std::pair<std::string, std::string>> parse_led_assignment(const std::string& arg)
+{
+    auto eq = arg.find('=');
+    if (eq == std::string::npos || eq == 0) return std::nullopt;
+    //else
+    auto name = arg.substr(0, eq);
+    if (!std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum((unsigned char)c) || c == '_' || c == '-'; })) return std::nullopt;
+    //else
+    if (name == "blink" || name == "gradient" || name == "chase" || name == "bar") return std::nullopt;
+    //else
+    return std::make_pair(name, arg.substr(eq + 1));
+}
+
+// Compare-and-set of the main LED, conditional on either the state version or the current action.  The
+// resulting version is printed as well, so that a script can retry from it after a conflict.
+int set_if(std::optional<uint64_t> expected_version, std::optional<std::string> expected_action, const std::string& action)
+{
+    bool success;
+    uint64_t version;
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        if (expected_version) proxy->callMethod("setIf").onInterface(interfaceName).withArguments(*expected_version, action).storeResultsTo(success, version);
+        else proxy->callMethod("setIfState").onInterface(interfaceName).withArguments(*expected_action, action).storeResultsTo(success, version);
+        std::cout << (success? "success" : "error") << " " << version << std::endl;
+        return success? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    //else
+#endif
+    varlink::Client client(varlink_socket);
+    auto reply = expected_version? client.call(interfaceName + ".SetIf", varlink_parameters({{"expected_version", std::to_string(*expected_version)}, {"action", json::quote(action)}}))
+        : client.call(interfaceName + ".SetIfState", varlink_parameters({{"expected_action", json::quote(*expected_action)}, {"action", json::quote(action)}}));
+    auto success_value = reply.get("success");
+    auto version_value = reply.get("version");
+    success = success_value && success_value->type == json::Value::BOOL && success_value->boolean;
+    version = version_value? version_value->as_uint().value_or(0) : 0;
+    std::cout << (success? "success" : "error") << " " << version << std::endl;
+    return success? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// sets all the given LEDs at once (setMany)
+int set_many(const std::map<std::string, std::string>& leds)
 {
-    auto proxy = sdbus::createProxy(serviceName, objectPath);
-    bool result;
-    proxy->callMethod("set").onInterface(interfaceName).withArguments(action).storeResultsTo(result);
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        bool result;
+        proxy->callMethod("setMany").onInterface(interfaceName).withArguments(leds).storeResultsTo(result);
+        std::cout << (result? "success" : "error") << std::endl;
+        return result? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    //else
+#endif
+    std::string leds_json;
+    for (const auto& [name, action] : leds) leds_json += (leds_json.empty()? "" : ",") + json::quote(name) + ":" + json::quote(action);
+    varlink::Client client(varlink_socket);
+    auto reply = client.call(interfaceName + ".SetMany", varlink_parameters({{"leds", "{" + leds_json + "}"}}));
+    auto success = reply.get("success");
+    bool result = success && success->type == json::Value::BOOL && success->boolean;
     std::cout << (result? "success" : "error") << std::endl;
     return result? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int get()
+int load_program(const std::string& path)
+{
+    std::string source;
+    if (path == "-") {
+        source.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        std::ifstream f(path);
+        if (!f) throw std::runtime_error("Cannot open " + path);
+        //else
+        source.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        bool result;
+        proxy->callMethod("loadProgram").onInterface(interfaceName).withArguments(source).storeResultsTo(result);
+        std::cout << (result? "success" : "error") << std::endl;
+        return result? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    //else
+#endif
+    varlink::Client(varlink_socket).call(interfaceName + ".LoadProgram", varlink_parameters({{"source", json::quote(source)}}));
+    std::cout << "success" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// with_version appends the state version, to be passed to set --if-version
+int get(std::optional<uint32_t> led = std::nullopt, bool with_version = false)
+{
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        std::string result, main_action;
+        uint64_t version;
+        if (with_version) proxy->callMethod("getState").onInterface(interfaceName).storeResultsTo(main_action, version);
+        if (led) proxy->callMethod("getLed").onInterface(interfaceName).withArguments(*led).storeResultsTo(result);
+        else if (with_version) result = main_action;
+        else proxy->callMethod("get").onInterface(interfaceName).storeResultsTo(result);
+        std::cout << result;
+        if (with_version) std::cout << " " << version;
+        std::cout << std::endl;
+        return EXIT_SUCCESS;
+    }
+    //else
+#endif
+    varlink::Client client(varlink_socket);
+    auto reply = client.call(interfaceName + ".Get", led? varlink_parameters({{"led", std::to_string(*led)}}) : "{}");
+    auto action = reply.get("action");
+    std::cout << (action && action->type == json::Value::STRING? action->string : "");
+    if (auto version = reply.get("version"); with_version && version) std::cout << " " << version->as_uint().value_or(0);
+    std::cout << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int stats()
+{
+#ifndef NO_DBUS
+    if (!use_varlink) {
+        auto proxy = sdbus::createProxy(serviceName, objectPath);
+        std::map<std::string, std::string> result;
+        proxy->callMethod("stats").onInterface(interfaceName).storeResultsTo(result);
+        for (const auto& [key, value] : result) {
+            std::cout << key << ": " << value << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+    //else
+#endif
+    varlink::Client client(varlink_socket);
+    auto reply = client.call(interfaceName + ".Stats", "{}");
+    if (auto result = reply.get("stats"); result && result->type == json::Value::OBJECT) {
+        for (const auto& [key, value] : result->object) {
+            std::cout << key << ": " << value.string << std::endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Blocks until the main LED's action becomes until (with until) or changes at all, through long-polling
+// waitChange calls; false on timeout.  Each call waits at most as long as the service holds one.
+int wait_for_change(const std::optional<std::string>& until, std::optional<unsigned int> timeout_s)
+{
+    const auto max_wait = std::chrono::milliseconds(defaults::max_wait_change_ms);
+    auto deadline = timeout_s? std::chrono::steady_clock::now() + std::chrono::seconds(*timeout_s) : std::chrono::steady_clock::time_point::max();
+    std::string action;
+    uint64_t version;
+    std::function<void(uint64_t, uint32_t)> wait_change;
+#ifndef NO_DBUS
+    std::unique_ptr<sdbus::IProxy> proxy;
+    if (!use_varlink) {
+        proxy = sdbus::createProxy(serviceName, objectPath);
+        proxy->callMethod("getState").onInterface(interfaceName).storeResultsTo(action, version);
+        wait_change = [&](uint64_t last_version, uint32_t timeout_ms) {
+            proxy->callMethod("waitChange").onInterface(interfaceName).withArguments(last_version, timeout_ms).storeResultsTo(action, version);
+        };
+    }
+#endif
+    std::unique_ptr<varlink::Client> client;
+    if (!wait_change) {
+        client = std::make_unique<varlink::Client>(varlink_socket);
+        auto store = [&](const json::Value& reply) {
+            auto action_value = reply.get("action");
+            auto version_value = reply.get("version");
+            auto number = version_value? version_value->as_uint() : std::nullopt;
+            if (!action_value || action_value->type != json::Value::STRING || !number) throw std::runtime_error("Malformed reply");
+            //else
+            action = action_value->string;
+            version = *number;
+        };
+        store(client->call(interfaceName + ".Get"));
+        wait_change = [&](uint64_t last_version, uint32_t timeout_ms) {
+            store(client->call(interfaceName + ".WaitChange", varlink_parameters({{"last_version", std::to_string(last_version)}, {"timeout_ms", std::to_string(timeout_ms)}})));
+        };
+    }
+
+    auto initial_version = version;
+    for (;;) {
+        if (until? action == *until : version != initial_version) {
+            std::cout << action << std::endl;
+            return EXIT_SUCCESS;
+        }
+        //else
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            std::cout << "timeout" << std::endl;
+            return EXIT_FAILURE;
+        }
+        //else
+        wait_change(version, std::max<uint32_t>(std::min(remaining, max_wait).count(), 1));
+    }
+}
+
+// follows the main LED's action until interrupted; only the Varlink interface streams changes
+int watch()
 {
-    auto proxy = sdbus::createProxy(serviceName, objectPath);
-    std::string result;
-    proxy->callMethod("get").onInterface(interfaceName).storeResultsTo(result);
-    std::cout << result << std::endl;
+    if (!use_varlink) throw std::runtime_error("watch requires --varlink");
+    //else
+    varlink::Client client(varlink_socket);
+    client.send_call(interfaceName + ".Watch", "{}", true);
+    for (;;) {
+        auto reply = client.receive();
+        auto parameters = reply.get("parameters");
+        auto action = parameters? parameters->get("action") : nullptr;
+        std::cout << (action && action->type == json::Value::STRING? action->string : "") << std::endl;
+        auto continues = reply.get("continues");
+        if (!continues || !continues->boolean) break;
+    }
     return EXIT_SUCCESS;
 }
 
@@ -184,7 +3494,16 @@ int unitfile(const std::string& chipname, unsigned int line_num)
     if (serviceName != defaults::serviceName) {
         opts1 += " --service-name=" + serviceName;
     }
+#ifndef NO_DBUS
+    if (use_varlink) opts1 += " --varlink";
+#endif
+    if (use_varlink && varlink_socket != defaults::varlink_socket) {
+        opts1 += " --varlink-socket=" + varlink_socket;
+    }
     std::string opts2 = "";
+#ifndef NO_DBUS
+    if (!use_dbus) opts2 += " --no-dbus";
+#endif
     if (chipname != defaults::chipname) {
         opts2 += " --chipname=" + chipname;
     }
@@ -199,14 +3518,14 @@ DefaultDependencies=no
 Before=network-pre.target
 
 [Service]
-Type=dbus
-BusName=SERVICE_NAME
+TYPE
 ExecStart=EXEPATHOPTS1 serviceOPTS2
 
 [Install]
 WantedBy=sysinit.target)";
     content.replace(content.find("PROGNAME"), 8, progname);
-    content.replace(content.find("SERVICE_NAME"), 12, serviceName);
+    // without D-Bus there is no bus name for systemd to wait for
+    content.replace(content.find("TYPE"), 4, use_dbus? "Type=dbus\nBusName=" + serviceName : "Type=simple");
     content.replace(content.find("EXEPATH"), 7, exepath);
     content.replace(content.find("OPTS1"), 5, opts1);
     content.replace(content.find("OPTS2"), 5, opts2);
@@ -214,31 +3533,106 @@ WantedBy=sysinit.target)";
     return EXIT_SUCCESS;
 }
 
+std::vector<unsigned int> parse_line_list(const std::string& list)
+{
+    std::vector<unsigned int> line_nums;
+    std::string_view rest = list;
+    while (!rest.empty()) {
+        auto comma = std::min(rest.find(','), rest.size());
+        line_nums.push_back(std::stoul(std::string(rest.substr(0, comma))));
+        rest.remove_prefix(std::min(comma + 1, rest.size()));
+    }
+    return line_nums;
+}
+
 int main(int argc, char** argv)
 {
     argparse::ArgumentParser program(progname);
     program.add_argument("-s", "--service-name").help("D-Bus service name").default_value(defaults::serviceName);
     program.add_argument("-o", "--object-path").help("D-Bus object path").default_value(defaults::objectPath);
     program.add_argument("-i", "--interface-name").help("D-Bus interface name").default_value(defaults::interfaceName);
+    program.add_argument("--varlink").help("Use the Varlink interface (service: serve it too)").default_value(false).implicit_value(true);
+    program.add_argument("--varlink-socket").help("Varlink socket path").default_value(defaults::varlink_socket);
 
     // "service" subcommand
     argparse::ArgumentParser service_command("service");
     service_command.add_description("Run as D-Bus service");
     service_command.add_argument("-c", "--chipname").help("GPIO chip name").default_value(defaults::chipname);
     service_command.add_argument("-l", "--line").help("GPIO line number").default_value(defaults::line_num).scan<'u', unsigned int>();
+    service_command.add_argument("--flash-on").help("Minimum on time of activity/watch flashes in milliseconds").default_value(defaults::flash_on_ms).scan<'u', unsigned int>();
+    service_command.add_argument("--flash-off").help("Minimum off time between activity/watch flashes in milliseconds").default_value(defaults::flash_off_ms).scan<'u', unsigned int>();
+    service_command.add_argument("--trigger-fifo").help("Create a FIFO accepting single-byte commands (1/0/b/f) at this path");
+    service_command.add_argument("-p", "--panel-lines").help("Comma separated GPIO lines of additional panel LEDs");
+    service_command.add_argument("--panel-names").help("Comma separated names of panel LEDs 0, 1, ... for set NAME=ACTION");
+    service_command.add_argument("--shift-register").help("Comma separated data, clock and latch lines of a 74HC595 chain driving the panel");
+    service_command.add_argument("--panel-size").help("Number of panel LEDs on the shift register chain").default_value(0U).scan<'u', unsigned int>();
+    service_command.add_argument("--panel-tick").help("Evaluate all panel LEDs every MS milliseconds instead of at their edges").default_value(0U).scan<'u', unsigned int>();
+    service_command.add_argument("--matrix-rows").help("Comma separated row lines of a multiplexed LED matrix panel (active high)");
+    service_command.add_argument("--matrix-cols").help("Comma separated column lines of the matrix (active low)");
+    service_command.add_argument("--matrix-refresh").help("Matrix refresh rate in Hz").default_value(defaults::matrix_refresh_hz).scan<'u', unsigned int>();
+    service_command.add_argument("--strip-device").help("spidev device (or plain file) of a WS2812 strip used as the panel");
+    service_command.add_argument("--strip-length").help("Number of pixels on the WS2812 strip").default_value(0U).scan<'u', unsigned int>();
+    service_command.add_argument("--strip-color").help("Colour of lit strip pixels as #rrggbb").default_value(defaults::strip_color);
+    service_command.add_argument("--strip-fps").help("Render the strip continuously at this frame rate (needed by animated effects)").default_value(0U).scan<'u', unsigned int>();
+    service_command.add_argument("--strip-main-pixel").help("Strip pixel showing the main LED when no other backend drives it").default_value(0U).scan<'u', unsigned int>();
+    service_command.add_argument("--strip-threads").help("Threads rendering strip frames").default_value(strip_threads).scan<'u', unsigned int>();
+    service_command.add_argument("--rgb-lines").help("Comma separated red, green and blue lines of an RGB main LED");
+    service_command.add_argument("--rgb-common-cathode").help("RGB LED lines are active high").default_value(false).implicit_value(true);
+    service_command.add_argument("--rgb-gamma").help("Gamma of the RGB channels, one value or r,g,b").default_value(defaults::rgb_gamma);
+    service_command.add_argument("--rgb-pwm").help("RGB PWM frequency in Hz").default_value(defaults::rgb_pwm_hz).scan<'u', unsigned int>();
+    service_command.add_argument("--rgb-bits").help("RGB PWM resolution in bits (1-16)").default_value(defaults::rgb_bits).scan<'u', unsigned int>();
+    service_command.add_argument("--rgb-no-dither").help("Disable temporal dithering of RGB duties").default_value(false).implicit_value(true);
+    service_command.add_argument("--pwm").help("Drive the main LED through kernel PWM channel CHIP:CHANNEL (e.g. 0:1 for GPIO13 of a Raspberry Pi) instead of --line");
+    service_command.add_argument("--pwm-root").help("sysfs PWM class directory").default_value(defaults::pwm_root);
+    service_command.add_argument("--led-class").help("Drive the main LED as kernel LED NAME, using its triggers where possible, instead of --line");
+    service_command.add_argument("--leds-root").help("sysfs LED class directory").default_value(defaults::leds_root);
+    service_command.add_argument("-b", "--button").help("Input line of a push button and its action (toggle, ack or cycle), e.g. 17:toggle").append();
+    service_command.add_argument("--button-debounce").help("Button debounce time in milliseconds").default_value(defaults::button_debounce_ms).scan<'u', unsigned int>();
+    service_command.add_argument("--sync-line").help("Input line carrying a reference pulse to phase-lock blinking to").scan<'u', unsigned int>();
+    service_command.add_argument("--sync-period").help("Period of the reference pulse in milliseconds").default_value(defaults::sync_period_ms).scan<'u', unsigned int>();
+    service_command.add_argument("--transmit-baud").help("Bit rate of transmit:<payload>").default_value(defaults::transmit_baud).scan<'u', unsigned int>();
+    service_command.add_argument("--no-dbus").help("Serve only the Varlink interface").default_value(false).implicit_value(true);
     program.add_subparser(service_command);
 
     // "set" subcommand
     argparse::ArgumentParser set_command("set");
     set_command.add_description("Set LED state");
-    set_command.add_argument("action");
+    set_command.add_argument("-n", "--led").help("Panel LED index instead of the main LED").scan<'u', uint32_t>();
+    set_command.add_argument("--if-version").help("Only if the state is still at this version (see get --with-version)").scan<'u', uint64_t>();
+    set_command.add_argument("--if-state").help("Only if the main LED's action is still this");
+    set_command.add_argument("action").help("Action, or NAME=ACTION... to set several panel LEDs at once").nargs(argparse::nargs_pattern::at_least_one);
     program.add_subparser(set_command);
 
+    // "program" subcommand
+    argparse::ArgumentParser program_command("program");
+    program_command.add_description("Upload and run an LED program");
+    program_command.add_argument("file").help("Program source file, - for stdin");
+    program.add_subparser(program_command);
+
     // "get" subcommand
     argparse::ArgumentParser get_command("get");
     get_command.add_description("Get LED state");
+    get_command.add_argument("-n", "--led").help("Panel LED index instead of the main LED").scan<'u', uint32_t>();
+    get_command.add_argument("--with-version").help("Also print the state version").default_value(false).implicit_value(true);
     program.add_subparser(get_command);
 
+    // "stats" subcommand
+    argparse::ArgumentParser stats_command("stats");
+    stats_command.add_description("Show service statistics");
+    program.add_subparser(stats_command);
+
+    // "watch" subcommand
+    argparse::ArgumentParser watch_command("watch");
+    watch_command.add_description("Print the LED state whenever it changes (Varlink only)");
+    program.add_subparser(watch_command);
+
+    // "wait" subcommand
+    argparse::ArgumentParser wait_command("wait");
+    wait_command.add_description("Wait until the LED state changes (or becomes a given action)");
+    wait_command.add_argument("--until").help("Action to wait for instead of any change");
+    wait_command.add_argument("--timeout").help("Give up after this many seconds (exit status 1)").scan<'u', unsigned int>();
+    program.add_subparser(wait_command);
+
     // "policyfile" subcommand
     argparse::ArgumentParser policyfile_command("policyfile");
     policyfile_command.add_description("Print D-Bus policy file");
@@ -249,6 +3643,7 @@ int main(int argc, char** argv)
     unitfile_command.add_description("Print systemd unit file");
     unitfile_command.add_argument("-c", "--chipname").help("GPIO chip name").default_value(defaults::chipname);
     unitfile_command.add_argument("-l", "--line").help("GPIO line number").default_value(defaults::line_num).scan<'u', unsigned int>();
+    unitfile_command.add_argument("--no-dbus").help("Run the service with --no-dbus (requires --varlink)").default_value(false).implicit_value(true);
     program.add_subparser(unitfile_command);
 
     try {
@@ -264,16 +3659,93 @@ int main(int argc, char** argv)
         serviceName = program.get<std::string>("service-name");
         objectPath = program.get<std::string>("object-path");
         interfaceName = program.get<std::string>("interface-name");
+        if (program.get<bool>("varlink")) use_varlink = true;
+        varlink_socket = program.get<std::string>("varlink-socket");
 
         if (program.is_subcommand_used("service")) {
+            flash_on_time = std::chrono::milliseconds(service_command.get<unsigned int>("flash-on"));
+            flash_off_time = std::chrono::milliseconds(service_command.get<unsigned int>("flash-off"));
+            if (auto path = service_command.present("trigger-fifo")) trigger_fifo_path = *path;
+            if (auto specs = service_command.present<std::vector<std::string>>("button")) button_specs = *specs;
+            if (auto lines = service_command.present("panel-lines")) panel_line_nums = parse_line_list(*lines);
+            if (auto names = service_command.present("panel-names")) {
+                for (std::string_view rest = *names; !rest.empty(); ) {
+                    auto comma = std::min(rest.find(','), rest.size());
+                    auto name = std::string(rest.substr(0, comma));
+                    if (!parse_led_assignment(name + "=on")) throw std::runtime_error("Invalid LED name: " + name);
+                    //else
+                    panel_names.push_back(name);
+                    rest.remove_prefix(std::min(comma + 1, rest.size()));
+                }
+            }
+            if (auto lines = service_command.present("shift-register")) shift_register_line_nums = parse_line_list(*lines);
+            panel_size = service_command.get<unsigned int>("panel-size");
+            panel_tick_ms = service_command.get<unsigned int>("panel-tick");
+            if (auto lines = service_command.present("matrix-rows")) matrix_row_line_nums = parse_line_list(*lines);
+            if (auto lines = service_command.present("matrix-cols")) matrix_col_line_nums = parse_line_list(*lines);
+            matrix_refresh_hz = service_command.get<unsigned int>("matrix-refresh");
+            if (auto device = service_command.present("strip-device")) strip_device = *device;
+            strip_length = service_command.get<unsigned int>("strip-length");
+            strip_color = service_command.get<std::string>("strip-color");
+            strip_fps = service_command.get<unsigned int>("strip-fps");
+            strip_threads = service_command.get<unsigned int>("strip-threads");
+            strip_main_pixel = service_command.get<unsigned int>("strip-main-pixel");
+            if (auto lines = service_command.present("rgb-lines")) rgb_line_nums = parse_line_list(*lines);
+            rgb_common_cathode = service_command.get<bool>("rgb-common-cathode");
+            rgb_gamma = service_command.get<std::string>("rgb-gamma");
+            rgb_pwm_hz = service_command.get<unsigned int>("rgb-pwm");
+            rgb_bits = service_command.get<unsigned int>("rgb-bits");
+            rgb_dither = !service_command.get<bool>("rgb-no-dither");
+            if (auto channel = service_command.present("pwm")) {
+                auto colon = channel->find(':');
+                if (colon == std::string::npos) throw std::runtime_error("--pwm takes CHIP:CHANNEL");
+                //else
+                pwm_channel = std::make_pair(std::stoul(channel->substr(0, colon)), std::stoul(channel->substr(colon + 1)));
+            }
+            pwm_root = service_command.get<std::string>("pwm-root");
+            if (auto name = service_command.present("led-class")) led_class_name = *name;
+            leds_root = service_command.get<std::string>("leds-root");
+            button_debounce_time = std::chrono::milliseconds(service_command.get<unsigned int>("button-debounce"));
+            sync_line_num = service_command.present<unsigned int>("sync-line");
+            sync_period = std::chrono::milliseconds(service_command.get<unsigned int>("sync-period"));
+            transmit_baud = service_command.get<unsigned int>("transmit-baud");
+            if (service_command.get<bool>("no-dbus")) use_dbus = false;
             return service(service_command.get<std::string>("chipname"), service_command.get<unsigned int>("line"));
         } else if (program.is_subcommand_used("set")) {
-            return set(set_command.get<std::string>("action"));
+            auto args = set_command.get<std::vector<std::string>>("action");
+            std::map<std::string, std::string> leds;
+            for (const auto& arg : args) {
+                if (auto assignment = parse_led_assignment(arg)) leds.insert(*assignment);
+            }
+            if (leds.size() == args.size() && !set_command.present<uint32_t>("led")) return set_many(leds);
+            //else
+            if (args.size() > 1) throw std::runtime_error("Several LEDs are set as NAME=ACTION...");
+            //else
+            auto if_version = set_command.present<uint64_t>("if-version");
+            auto if_state = set_command.present("if-state");
+            if (if_version || if_state) {
+                if ((if_version && if_state) || set_command.present<uint32_t>("led")) throw std::runtime_error("--if-version or --if-state applies to the main LED only");
+                //else
+                return set_if(if_version, if_state, args[0]);
+            }
+            //else
+            return set(args[0], set_command.present<uint32_t>("led"));
+        } else if (program.is_subcommand_used("program")) {
+            return load_program(program_command.get<std::string>("file"));
         } else if (program.is_subcommand_used("get")) {
-            return get();
+            return get(get_command.present<uint32_t>("led"), get_command.get<bool>("with-version"));
+        } else if (program.is_subcommand_used("stats")) {
+            return stats();
+        } else if (program.is_subcommand_used("wait")) {
+            return wait_for_change(wait_command.present("until"), wait_command.present<unsigned int>("timeout"));
+        } else if (program.is_subcommand_used("watch")) {
+            return watch();
         } else if (program.is_subcommand_used("policyfile")) {
             return policyfile();
         } else if (program.is_subcommand_used("unitfile")) {
+            if (unitfile_command.get<bool>("no-dbus")) use_dbus = false;
+            if (!use_dbus && !use_varlink) throw std::runtime_error("--no-dbus requires --varlink");
+            //else
             return unitfile(unitfile_command.get<std::string>("chipname"), unitfile_command.get<unsigned int>("line"));
         } else {
             std::cerr << program;
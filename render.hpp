@@ -0,0 +1,262 @@
+/**
+ * LED Indicator - effects rendering for addressable LED strips
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <array>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Renders a strip frame (GRB bytes, 3 per pixel) from effects spanning pixel ranges, with the panel's
+// on/off bits drawn on top.  Every pixel depends only on the effects and the frame time, so a frame is
+// split into pixel ranges that are rendered independently by a WorkerPool.
+namespace render {
+
+// parses #rrggbb (the # is optional) into r, g, b
+inline std::optional<std::array<uint8_t, 3>> parse_color(std::string_view color)
+{
+    if (color.starts_with('#')) color.remove_prefix(1);
+    uint32_t value;
+    auto [ptr, ec] = std::from_chars(color.data(), color.data() + color.size(), value, 16);
+    if (color.size() != 6 || ec != std::errc() || ptr != color.data() + color.size()) return std::nullopt;
+    //else
+    return std::array<uint8_t, 3>{(uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+}
+
+// gradient=LENGTH,#from,#to   static linear blend
+// chase=LENGTH,#color,PERIOD  a dot with a fading tail running along the range once per PERIOD ms
+// bar=LENGTH,#color,PERCENT   the first PERCENT of the range lit, like a level meter
+struct Effect {
+    enum Kind { GRADIENT, CHASE, BAR };
+    Kind kind;
+    uint32_t first, length;
+    std::array<uint8_t, 3> color, to;  // rgb
+    uint32_t value;                    // period ms for chase, percent for bar
+    std::string spec;
+
+    static std::optional<Effect> parse(uint32_t first, const std::string& spec)
+    {
+        auto eq = spec.find('=');
+        if (eq == std::string::npos) return std::nullopt;
+        //else
+        std::string_view name(spec.data(), eq), args(spec.data() + eq + 1, spec.size() - eq - 1);
+        std::vector<std::string_view> fields;
+        for (size_t comma; (comma = args.find(',')) != std::string_view::npos; args.remove_prefix(comma + 1)) fields.push_back(args.substr(0, comma));
+        fields.push_back(args);
+        if (fields.size() != 3) return std::nullopt;
+        //else
+        auto to_u32 = [](std::string_view s) -> std::optional<uint32_t> {
+            uint32_t value;
+            auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+            if (ec != std::errc() || ptr != s.data() + s.size()) return std::nullopt;
+            //else
+            return value;
+        };
+        auto length = to_u32(fields[0]);
+        auto color = parse_color(fields[1]);
+        if (!length || *length == 0 || !color) return std::nullopt;
+        //else
+        Effect effect{GRADIENT, first, *length, *color, {}, 0, spec};
+        if (name == "gradient") {
+            auto to = parse_color(fields[2]);
+            if (!to) return std::nullopt;
+            effect.to = *to;
+            return effect;
+        }
+        //else
+        auto value = to_u32(fields[2]);
+        if (!value) return std::nullopt;
+        effect.value = *value;
+        if (name == "chase" && *value > 0) effect.kind = CHASE;
+        else if (name == "bar" && *value <= 100) effect.kind = BAR;
+        else return std::nullopt;
+        return effect;
+    }
+
+    bool is_animated() const { return kind == CHASE; }
+
+    // renders pixels [begin, end) of the strip that fall in this effect's range
+    void render(uint64_t t_ms, size_t begin, size_t end, uint8_t* grb) const
+    {
+        begin = std::max<size_t>(begin, first);
+        end = std::min<size_t>(end, (size_t)first + length);
+        for (size_t i = begin; i < end; i++) {
+            uint32_t j = i - first, level = 256;  // level is 0..256
+            const std::array<uint8_t, 3>* c = &color;
+            std::array<uint8_t, 3> blended;
+            switch (kind) {
+            case GRADIENT:
+                for (int k = 0; k < 3; k++) blended[k] = length > 1? color[k] + ((int)to[k] - color[k]) * (int)j / (int)(length - 1) : color[k];
+                c = &blended;
+                break;
+            case CHASE: {
+                uint32_t head = (t_ms % value) * length / value;
+                uint32_t tail = std::max<uint32_t>(length / 8, 1);
+                uint32_t distance = (head + length - j) % length;
+                level = distance < tail? 256 - distance * 256 / tail : 0;
+                break;
+            }
+            case BAR:
+                level = j * 100 < length * value? 256 : 0;
+                break;
+            }
+            grb[i * 3] = (*c)[1] * level >> 8;
+            grb[i * 3 + 1] = (*c)[0] * level >> 8;
+            grb[i * 3 + 2] = (*c)[2] * level >> 8;
+        }
+    }
+};
+
+// renders pixels [begin, end): effects first, then panel LEDs that are on in the on colour
+inline void render_range(const std::vector<Effect>& effects, const uint64_t* bits, const std::array<uint8_t, 3>& on_rgb,
+    uint64_t t_ms, size_t begin, size_t end, uint8_t* grb)
+{
+    std::fill(grb + begin * 3, grb + end * 3, 0);
+    for (const auto& effect : effects) effect.render(t_ms, begin, end, grb);
+    for (size_t i = begin; i < end; i++) {
+        if (!((bits[i / 64] >> (i % 64)) & 1)) continue;
+        //else
+        grb[i * 3] = on_rgb[1];
+        grb[i * 3 + 1] = on_rgb[0];
+        grb[i * 3 + 2] = on_rgb[2];
+    }
+}
+
+// Fixed set of threads that run a job over index ranges.  run() splits [0, total) into chunks and deals
+// them out in contiguous blocks, one queue per participant (the calling thread is participant 0).  A
+// participant takes its own chunks from the front and, once out of work, steals from the back of the
+// others' queues, so an uneven split (or a descheduled worker) does not hold up the frame.  There are
+// never more participants than CPUs, and with one participant or one chunk the calling thread runs the
+// job by itself, since waking threads that cannot run in parallel only adds to the frame time.
+class WorkerPool {
+public:
+    using Job = std::function<void(size_t, size_t)>;
+private:
+    struct Chunk { const Job* job; size_t begin, end; };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    uint64_t generation = 0;
+    bool stopping = false;
+    std::atomic<size_t> remaining{0};
+    std::atomic<uint64_t> steals{0};
+
+    std::optional<Chunk> take(size_t self)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            auto& own = queues[self]->chunks;
+            if (!own.empty()) {
+                auto chunk = own.front();
+                own.pop_front();
+                return chunk;
+            }
+        }
+        for (size_t n = 1; n < queues.size(); n++) {
+            auto& victim = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.chunks.empty()) continue;
+            //else
+            auto chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return chunk;
+        }
+        return std::nullopt;
+    }
+
+    void work(size_t self)
+    {
+        while (auto chunk = take(self)) {
+            (*chunk->job)(chunk->begin, chunk->end);
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+public:
+    WorkerPool(size_t participants)
+    {
+        if (auto cpus = std::thread::hardware_concurrency(); cpus > 0) participants = std::min<size_t>(participants, cpus);
+        participants = std::max<size_t>(participants, 1);
+        for (size_t i = 0; i < participants; i++) queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 1; i < participants; i++) {
+            threads.emplace_back([this, i]() {
+                uint64_t seen = 0;
+                for (;;) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&]() { return stopping || generation != seen; });
+                        if (stopping) return;
+                        //else
+                        seen = generation;
+                    }
+                    work(i);
+                }
+            });
+        }
+    }
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    size_t size() const { return queues.size(); }
+    uint64_t get_steals() const { return steals.load(std::memory_order_relaxed); }
+
+    // runs job over [0, total) in chunks of up to grain indices and returns once every chunk is done
+    void run(size_t total, size_t grain, const Job& job)
+    {
+        size_t chunks = (total + grain - 1) / grain;
+        if (chunks == 0) return;
+        //else
+        if (chunks == 1 || queues.size() == 1) {
+            job(0, total);
+            return;
+        }
+        //else
+        remaining.store(chunks, std::memory_order_relaxed);
+        for (size_t q = 0; q < queues.size(); q++) {
+            std::lock_guard<std::mutex> lock(queues[q]->mutex);
+            for (size_t c = chunks * q / queues.size(); c < chunks * (q + 1) / queues.size(); c++) {
+                queues[q]->chunks.push_back({&job, c * grain, std::min(total, (c + 1) * grain)});
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return remaining.load(std::memory_order_acquire) == 0; });
+    }
+};
+
+} // namespace render
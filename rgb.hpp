@@ -0,0 +1,120 @@
+/**
+ * LED Indicator - colour mixing for RGB LEDs on plain GPIO lines
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <time.h>
+
+// An RGB LED on three GPIO lines mixes colours by PWM: every period all channels with a non-zero duty turn
+// on together and each turns off after its duty.  The duty of a channel comes from its gamma LUT as a
+// linear fraction with 16 fractional bits, which the Modulator quantizes to the PWM resolution (bits).
+// With dithering, each period's quantization error is carried into the next one (first-order
+// sigma-delta), so the average over a few periods keeps the full 16 bits even at a coarse resolution, and
+// the carrier frequency does not have to rise with the bit depth.
+namespace rgb {
+
+using Color = std::array<uint8_t, 3>;  // r, g, b
+
+constexpr unsigned level_bits = 16;
+constexpr uint32_t full_level = 1u << level_bits;
+
+// 8-bit channel value -> linear duty in 1/65536ths of the period
+class GammaLut {
+    std::array<uint32_t, 256> table;
+public:
+    GammaLut(double gamma = 2.2)
+    {
+        for (int v = 0; v < 256; v++) table[v] = (uint32_t)std::lround(std::pow(v / 255.0, gamma) * full_level);
+    }
+    uint32_t operator[](uint8_t v) const { return table[v]; }
+};
+
+class Modulator {
+    unsigned bits;
+    bool dither;
+    std::array<uint32_t, 3> error = {};
+public:
+    Modulator(unsigned _bits, bool _dither) : bits(_bits), dither(_dither) {}
+
+    unsigned get_bits() const { return bits; }
+    uint32_t steps() const { return 1u << bits; }
+
+    // duty of the next period of each channel in PWM steps (0 = off, steps() = on throughout)
+    void next(const std::array<uint32_t, 3>& levels, std::array<uint32_t, 3>& duties)
+    {
+        const unsigned shift = level_bits - bits;
+        for (int k = 0; k < 3; k++) {
+            if (!dither) {
+                duties[k] = (levels[k] + (1u << shift >> 1)) >> shift;
+                continue;
+            }
+            if (levels[k] == 0 || levels[k] == full_level) {
+                // nothing to spread at the extremes; a leftover error would keep the PWM running forever
+                duties[k] = levels[k] == 0? 0 : steps();
+                error[k] = 0;
+                continue;
+            }
+            //else
+            auto acc = levels[k] + error[k];
+            duties[k] = std::min(acc >> shift, steps());
+            error[k] = acc - (duties[k] << shift);
+        }
+    }
+
+    // whether every following period will be the same, so PWM can stop until the levels change
+    bool is_steady(const std::array<uint32_t, 3>& levels) const
+    {
+        for (int k = 0; k < 3; k++) {
+            if (error[k] != 0 || (levels[k] != 0 && levels[k] != full_level)) return false;
+        }
+        return true;
+    }
+};
+
+inline void sleep_until(std::chrono::steady_clock::time_point deadline)
+{
+    struct timespec ts;
+    auto since_epoch = deadline.time_since_epoch();
+    ts.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch % std::chrono::seconds(1)).count();
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) ;
+}
+
+// Plays one PWM period starting at start: write(on) gets the state of all three channels at the period
+// start and again at each distinct off edge, so channels that switch together share a write.  Writes that
+// would not change anything are skipped; returns how many were made.
+template <typename Write> unsigned play_period(const std::array<uint32_t, 3>& duties, uint32_t steps,
+    std::chrono::steady_clock::time_point start, std::chrono::nanoseconds period, std::array<bool, 3>& on, Write write)
+{
+    unsigned writes = 0;
+    auto apply = [&](const std::array<bool, 3>& next, std::chrono::steady_clock::time_point t) {
+        if (next == on) return;
+        //else
+        sleep_until(t);
+        write(next);
+        on = next;
+        writes++;
+    };
+    std::array<bool, 3> next;
+    for (int k = 0; k < 3; k++) next[k] = duties[k] > 0;
+    apply(next, start);
+    auto edges = duties;
+    std::sort(edges.begin(), edges.end());
+    for (auto edge : edges) {
+        if (edge == 0 || edge >= steps) continue;
+        //else
+        for (int k = 0; k < 3; k++) next[k] = next[k] && duties[k] != edge;
+        apply(next, start + period * edge / steps);
+    }
+    return writes;
+}
+
+} // namespace rgb
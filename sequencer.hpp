@@ -0,0 +1,235 @@
+/**
+ * LED Indicator - coroutine based sequencing runtime
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <coroutine>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+// Runs many timed LED sequences on one thread.  A sequence is a coroutine returning sequencer::Task that
+// co_awaits sleep_until(deadline) or on_event(event).  Suspended sequences are kept in a single min-heap of
+// resumption deadlines, so the service loop only has to sleep until next_deadline() and call run_due().
+// Coroutine frames come from a size-bucketed free list, so stepping and respawning never hit the heap
+// once the pool is warm.
+namespace sequencer {
+
+using clock = std::chrono::steady_clock;
+
+class FramePool {
+    static constexpr size_t granularity = 16, buckets = 64;  // pooled frames up to 1KiB
+    struct Block { Block* next; };
+    Block* free_lists[buckets] = {};
+    uint64_t allocations = 0, reuses = 0;
+public:
+    static FramePool& instance()
+    {
+        static FramePool pool;
+        return pool;
+    }
+    ~FramePool()
+    {
+        for (auto& head : free_lists) {
+            while (head) {
+                auto next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    void* allocate(size_t size)
+    {
+        auto bucket = (size + granularity - 1) / granularity;
+        if (bucket >= buckets) {
+            allocations++;
+            return ::operator new(size);
+        }
+        //else
+        if (auto block = free_lists[bucket]) {
+            free_lists[bucket] = block->next;
+            reuses++;
+            return block;
+        }
+        //else
+        allocations++;
+        return ::operator new(bucket * granularity);
+    }
+
+    void deallocate(void* p, size_t size)
+    {
+        auto bucket = (size + granularity - 1) / granularity;
+        if (bucket >= buckets) {
+            ::operator delete(p);
+            return;
+        }
+        //else
+        auto block = static_cast<Block*>(p);
+        block->next = free_lists[bucket];
+        free_lists[bucket] = block;
+    }
+
+    uint64_t get_allocations() const { return allocations; }
+    uint64_t get_reuses() const { return reuses; }
+};
+
+class Scheduler;
+
+class Task {
+public:
+    struct promise_type {
+        Scheduler* scheduler = nullptr;
+        size_t index = 0;  // position in the scheduler's list of live tasks
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }  // the scheduler destroys finished tasks
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::instance().allocate(size); }
+        static void operator delete(void* p, size_t size) { FramePool::instance().deallocate(p, size); }
+    };
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    Task(const Task&) = delete;
+    ~Task() { if (handle) handle.destroy(); }
+
+    handle_type release()
+    {
+        auto h = handle;
+        handle = nullptr;
+        return h;
+    }
+private:
+    explicit Task(handle_type h) : handle(h) {}
+    handle_type handle;
+};
+
+class Scheduler {
+    struct Entry {
+        clock::time_point deadline;
+        uint64_t seq;  // keeps FIFO order among equal deadlines
+        Task::handle_type handle;
+        bool operator>(const Entry& other) const { return deadline != other.deadline? deadline > other.deadline : seq > other.seq; }
+    };
+    std::vector<Entry> heap;
+    std::vector<Task::handle_type> tasks;  // every live task, including those waiting on an Event
+    uint64_t seq = 0, resumes = 0;
+
+    void finish(Task::handle_type handle)
+    {
+        auto index = handle.promise().index;
+        tasks[index] = tasks.back();
+        tasks[index].promise().index = index;
+        tasks.pop_back();
+        handle.destroy();
+    }
+public:
+    Scheduler(size_t capacity = 64)
+    {
+        // construct the pool first so that it outlives this scheduler's frames (statics die in reverse order)
+        FramePool::instance();
+        heap.reserve(capacity);
+        tasks.reserve(capacity);
+    }
+    Scheduler(const Scheduler&) = delete;
+    // Events that tasks are still waiting on must not be notified afterwards
+    ~Scheduler()
+    {
+        for (auto handle : tasks) handle.destroy();
+    }
+
+    void schedule(Task::handle_type handle, clock::time_point deadline)
+    {
+        heap.push_back({deadline, seq++, handle});
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+    }
+
+    // starts the sequence at the next run_due()
+    void spawn(Task&& task, clock::time_point start = clock::now())
+    {
+        auto handle = task.release();
+        handle.promise().scheduler = this;
+        handle.promise().index = tasks.size();
+        tasks.push_back(handle);
+        schedule(handle, start);
+    }
+
+    clock::time_point next_deadline() const
+    {
+        return heap.empty()? clock::time_point::max() : heap.front().deadline;
+    }
+
+    // resumes every sequence whose deadline has passed; returns how many were resumed
+    size_t run_due(clock::time_point now)
+    {
+        size_t count = 0;
+        while (!heap.empty() && heap.front().deadline <= now) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+            auto handle = heap.back().handle;
+            heap.pop_back();
+            handle.resume();
+            count++;
+            if (handle.done()) finish(handle);
+        }
+        resumes += count;
+        return count;
+    }
+
+    size_t size() const { return tasks.size(); }
+    uint64_t get_resumes() const { return resumes; }
+};
+
+struct SleepUntil {
+    clock::time_point deadline;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(Task::handle_type handle) const { handle.promise().scheduler->schedule(handle, deadline); }
+    void await_resume() const noexcept {}
+};
+
+inline SleepUntil sleep_until(clock::time_point deadline) { return {deadline}; }
+
+// Wakes every sequence waiting on it.  Waiters are linked through their awaiters, which live in the
+// suspended coroutine frames, so waiting does not allocate either.
+class Event {
+public:
+    struct Awaiter {
+        Event& event;
+        Task::handle_type handle;
+        Awaiter* next = nullptr;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Task::handle_type h)
+        {
+            handle = h;
+            next = event.waiters;
+            event.waiters = this;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    void notify(clock::time_point now = clock::now())
+    {
+        auto waiter = waiters;
+        waiters = nullptr;
+        while (waiter) {
+            auto next = waiter->next;  // the awaiter is gone once its coroutine resumes
+            waiter->handle.promise().scheduler->schedule(waiter->handle, now);
+            waiter = next;
+        }
+    }
+private:
+    Awaiter* waiters = nullptr;
+};
+
+inline Event::Awaiter on_event(Event& event) { return {event, nullptr, nullptr}; }
+
+} // namespace sequencer
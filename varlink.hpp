@@ -0,0 +1,531 @@
+/**
+ * LED Indicator - minimal Varlink server and client over a Unix socket
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <optional>
+#include <functional>
+#include <stdexcept>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+
+// Just enough JSON for Varlink messages: parse() builds a tree of Values, replies are put together as
+// text with quote() for strings.
+namespace json {
+
+struct Value {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Value> array;
+    std::map<std::string, Value> object;
+
+    const Value* get(const std::string& key) const
+    {
+        if (type != OBJECT) return nullptr;
+        //else
+        auto i = object.find(key);
+        return i == object.end()? nullptr : &i->second;
+    }
+
+    // the number if it is an integer in 0..max; converting anything else to an unsigned type is undefined
+    std::optional<uint64_t> as_uint(uint64_t max = UINT64_MAX) const
+    {
+        if (type != NUMBER || !std::isfinite(number) || number < 0 || number != std::trunc(number) || number >= 18446744073709551616.0) return std::nullopt;
+        //else
+        auto value = (uint64_t)number;
+        if (value > max) return std::nullopt;
+        //else
+        return value;
+    }
+};
+
+class Parser {
+    static constexpr int max_depth = 32;
+    std::string_view s;
+    size_t pos = 0;
+
+    void skip_space() { while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r')) pos++; }
+    bool consume(std::string_view token)
+    {
+        if (s.substr(pos, token.size()) != token) return false;
+        //else
+        pos += token.size();
+        return true;
+    }
+
+    static void append_utf8(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80) out += (char)cp;
+        else if (cp < 0x800) { out += (char)(0xc0 | cp >> 6); out += (char)(0x80 | (cp & 0x3f)); }
+        else if (cp < 0x10000) { out += (char)(0xe0 | cp >> 12); out += (char)(0x80 | (cp >> 6 & 0x3f)); out += (char)(0x80 | (cp & 0x3f)); }
+        else { out += (char)(0xf0 | cp >> 18); out += (char)(0x80 | (cp >> 12 & 0x3f)); out += (char)(0x80 | (cp >> 6 & 0x3f)); out += (char)(0x80 | (cp & 0x3f)); }
+    }
+
+    bool parse_hex4(uint32_t& cp)
+    {
+        if (pos + 4 > s.size()) return false;
+        //else
+        auto [ptr, ec] = std::from_chars(s.data() + pos, s.data() + pos + 4, cp, 16);
+        if (ec != std::errc() || ptr != s.data() + pos + 4) return false;
+        //else
+        pos += 4;
+        return true;
+    }
+
+    bool parse_string(std::string& out)
+    {
+        if (!consume("\"")) return false;
+        //else
+        while (pos < s.size()) {
+            char c = s[pos++];
+            if (c == '"') return true;
+            if ((unsigned char)c < 0x20) return false;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            //else
+            if (pos >= s.size()) return false;
+            //else
+            switch (s[pos++]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (!parse_hex4(cp)) return false;
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    uint32_t low;
+                    if (!consume("\\u") || !parse_hex4(low) || low < 0xdc00 || low >= 0xe000) return false;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: return false;
+            }
+        }
+        return false;
+    }
+
+    bool parse_value(Value& value, int depth)
+    {
+        if (depth > max_depth) return false;
+        //else
+        skip_space();
+        if (pos >= s.size()) return false;
+        //else
+        if (consume("null")) { value.type = Value::NUL; return true; }
+        if (consume("true")) { value.type = Value::BOOL; value.boolean = true; return true; }
+        if (consume("false")) { value.type = Value::BOOL; value.boolean = false; return true; }
+        if (s[pos] == '"') {
+            value.type = Value::STRING;
+            return parse_string(value.string);
+        }
+        if (consume("[")) {
+            value.type = Value::ARRAY;
+            skip_space();
+            if (consume("]")) return true;
+            //else
+            do {
+                value.array.emplace_back();
+                if (!parse_value(value.array.back(), depth + 1)) return false;
+                skip_space();
+            } while (consume(","));
+            return consume("]");
+        }
+        if (consume("{")) {
+            value.type = Value::OBJECT;
+            skip_space();
+            if (consume("}")) return true;
+            //else
+            do {
+                skip_space();
+                std::string key;
+                if (!parse_string(key)) return false;
+                skip_space();
+                if (!consume(":")) return false;
+                if (!parse_value(value.object[key], depth + 1)) return false;
+                skip_space();
+            } while (consume(","));
+            return consume("}");
+        }
+        //else
+        value.type = Value::NUMBER;
+        auto [ptr, ec] = std::from_chars(s.data() + pos, s.data() + s.size(), value.number);
+        if (ec != std::errc()) return false;
+        //else
+        pos = ptr - s.data();
+        return true;
+    }
+public:
+    Parser(std::string_view _s) : s(_s) {}
+
+    std::optional<Value> parse()
+    {
+        Value value;
+        if (!parse_value(value, 0)) return std::nullopt;
+        //else
+        skip_space();
+        if (pos != s.size()) return std::nullopt;
+        //else
+        return value;
+    }
+};
+
+inline std::optional<Value> parse(std::string_view s) { return Parser(s).parse(); }
+
+inline std::string quote(std::string_view s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+} // namespace json
+
+// Varlink (https://varlink.org/) over a Unix stream socket: every message is one JSON object; a call is
+// {"method": "iface.Method", "parameters": {...}, "more": true?, "oneway": true?} and a reply is
+// {"parameters": {...}, "continues": true?} or {"error": "iface.Error", "parameters": {...}}.  Messages are
+// terminated by a NUL byte as the protocol specifies; a newline is accepted as well so that the socket can
+// be driven by hand (e.g. with socat), and each client gets replies terminated the way it sent its calls.
+//
+// The server never blocks: it lives in the caller's poll loop through add_poll_fds()/handle_poll_event()
+// and queues output that the socket does not take at once.  A handler can also leave a call unanswered
+// (deferred) and answer it later through deferred_reply(); the client's further calls wait until then, so
+// replies stay in call order.  A close handler learns which clients have gone, e.g. to forget their calls.
+namespace varlink {
+
+struct Call {
+    std::string method;
+    json::Value parameters;  // always an object
+    bool more = false, oneway = false;
+};
+
+class Server {
+public:
+    class Client {
+        friend class Server;
+        int fd;
+        uint64_t id;
+        std::string in, out;
+        char terminator = '\0';
+        bool closing = false;
+    public:
+        bool more = false;  // the call being answered asked for a stream
+        bool watching = false;  // set by handlers that keep the call open to stream replies later
+        bool deferred = false;  // set by handlers that answer the call later through Server::deferred_reply()
+
+        uint64_t get_id() const { return id; }
+
+        // parameters_json must be a JSON object
+        void reply(const std::string& parameters_json, bool continues = false)
+        {
+            if (oneway_call) return;
+            //else
+            out += "{\"parameters\":" + parameters_json + (continues? ",\"continues\":true}" : "}");
+            out += terminator;
+        }
+        void error(const std::string& name, const std::string& parameters_json = "{}")
+        {
+            if (oneway_call) return;
+            //else
+            out += "{\"error\":" + json::quote(name) + ",\"parameters\":" + parameters_json + "}";
+            out += terminator;
+        }
+    private:
+        bool oneway_call = false;
+    };
+    using Handler = std::function<void(Client&, const Call&)>;
+    using CloseHandler = std::function<void(uint64_t id)>;
+private:
+    static constexpr size_t max_message = 65536, max_backlog = 1 << 20;
+    std::string path;
+    int listen_fd;
+    std::map<int, Client> clients;
+    Handler handler;
+    CloseHandler close_handler;
+    uint64_t calls = 0, connections = 0;
+
+    std::map<int, Client>::iterator drop(std::map<int, Client>::iterator i)
+    {
+        auto id = i->second.id;
+        close(i->second.fd);
+        i = clients.erase(i);
+        if (close_handler) close_handler(id);
+        return i;
+    }
+
+    void flush(Client& client)
+    {
+        while (!client.out.empty()) {
+            auto n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) client.closing = true;
+                break;
+            }
+            //else
+            client.out.erase(0, n);
+        }
+        if (client.out.size() > max_backlog) client.closing = true;  // a watcher that stopped reading
+    }
+
+    void handle_message(Client& client, std::string_view message)
+    {
+        auto value = json::parse(message);
+        const json::Value* method = value? value->get("method") : nullptr;
+        if (!method || method->type != json::Value::STRING) {
+            client.closing = true;  // not Varlink; nothing sensible to reply
+            return;
+        }
+        //else
+        Call call;
+        call.method = method->string;
+        if (auto parameters = value->get("parameters"); parameters && parameters->type == json::Value::OBJECT) call.parameters = *parameters;
+        else call.parameters.type = json::Value::OBJECT;
+        if (auto more = value->get("more"); more && more->type == json::Value::BOOL) call.more = more->boolean;
+        if (auto oneway = value->get("oneway"); oneway && oneway->type == json::Value::BOOL) call.oneway = oneway->boolean;
+        client.more = call.more;
+        client.oneway_call = call.oneway;
+        calls++;
+        handler(client, call);
+        client.oneway_call = false;
+    }
+
+    // handles the complete messages received so far, up to a call that is answered later
+    void process_input(Client& client)
+    {
+        size_t start = 0;
+        for (size_t i = 0; i < client.in.size() && !client.closing && !client.deferred; i++) {
+            if (client.in[i] != '\0' && client.in[i] != '\n') continue;
+            //else
+            client.terminator = client.in[i];
+            if (i > start) handle_message(client, std::string_view(client.in).substr(start, i - start));
+            start = i + 1;
+        }
+        client.in.erase(0, start);
+        if (client.in.size() > max_message) client.closing = true;
+    }
+
+    void read_from(Client& client)
+    {
+        char buf[4096];
+        for (;;) {
+            auto n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                client.closing = true;
+                return;
+            }
+            if (n < 0) break;
+            //else
+            client.in.append(buf, n);
+        }
+        process_input(client);
+    }
+public:
+    Server(const std::string& _path, Handler _handler, mode_t mode = 0660) : path(_path), handler(std::move(_handler))
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        //else
+        std::strcpy(addr.sun_path, path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+        //else
+        unlink(path.c_str());  // a stale socket from a previous run
+        if (bind(listen_fd, (const sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path.c_str(), mode) < 0 || listen(listen_fd, 16) < 0) {
+            auto err = errno;
+            close(listen_fd);
+            throw std::runtime_error("Unable to listen on " + path + ": " + strerror(err));
+        }
+    }
+    ~Server()
+    {
+        for (auto& [fd, client] : clients) close(fd);
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+
+    void on_close(CloseHandler _close_handler) { close_handler = std::move(_close_handler); }
+
+    void add_poll_fds(std::vector<pollfd>& fds) const
+    {
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (const auto& [fd, client] : clients) fds.push_back({fd, (short)(POLLIN | (client.out.empty()? 0 : POLLOUT)), 0});
+    }
+
+    void handle_poll_event(const pollfd& pfd)
+    {
+        if (pfd.fd == listen_fd) {
+            int fd;
+            while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                clients[fd].fd = fd;
+                clients[fd].id = ++connections;
+            }
+            return;
+        }
+        //else
+        auto i = clients.find(pfd.fd);
+        if (i == clients.end()) return;
+        //else
+        auto& client = i->second;
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) read_from(client);
+        flush(client);
+        if (client.closing) drop(i);
+    }
+
+    // sends a streamed reply to every client whose call is being watched
+    void notify_watchers(const std::string& parameters_json)
+    {
+        for (auto i = clients.begin(); i != clients.end(); ) {
+            auto& client = i->second;
+            if (client.watching) {
+                client.reply(parameters_json, true);
+                flush(client);
+            }
+            if (client.closing) i = drop(i);
+            else ++i;
+        }
+    }
+
+    // answers a deferred call of the client with the given id; false if it has gone away meanwhile
+    bool deferred_reply(uint64_t id, const std::string& parameters_json)
+    {
+        auto i = std::find_if(clients.begin(), clients.end(), [id](const auto& entry) { return entry.second.id == id; });
+        if (i == clients.end() || !i->second.deferred) return false;
+        //else
+        auto& client = i->second;
+        client.deferred = false;
+        client.reply(parameters_json, false);
+        process_input(client);
+        flush(client);
+        if (client.closing) drop(i);
+        return true;
+    }
+
+    size_t get_watchers() const
+    {
+        size_t count = 0;
+        for (const auto& [fd, client] : clients) count += client.watching;
+        return count;
+    }
+    size_t get_clients() const { return clients.size(); }
+    uint64_t get_calls() const { return calls; }
+    uint64_t get_connections() const { return connections; }
+};
+
+// Blocking client: one connection, calls answered in order.
+class Client {
+    int fd;
+    std::string in;
+public:
+    Client(const std::string& path)
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        //else
+        std::strcpy(addr.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+        //else
+        if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+            auto err = errno;
+            close(fd);
+            throw std::runtime_error("Unable to connect to " + path + ": " + strerror(err));
+        }
+    }
+    ~Client() { close(fd); }
+    Client(const Client&) = delete;
+
+    void send_call(const std::string& method, const std::string& parameters_json = "{}", bool more = false)
+    {
+        std::string message = "{\"method\":" + json::quote(method) + ",\"parameters\":" + parameters_json + (more? ",\"more\":true}" : "}");
+        message += '\0';
+        for (size_t sent = 0; sent < message.size(); ) {
+            auto n = send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+            if (n < 0) throw std::runtime_error(std::string("send: ") + strerror(errno));
+            //else
+            sent += n;
+        }
+    }
+
+    // next reply; throws on a Varlink error reply
+    json::Value receive()
+    {
+        for (;;) {
+            auto end = in.find('\0');
+            if (end != std::string::npos) {
+                auto message = json::parse(std::string_view(in).substr(0, end));
+                in.erase(0, end + 1);
+                if (!message) throw std::runtime_error("Malformed reply");
+                //else
+                if (auto error = message->get("error")) throw std::runtime_error(error->type == json::Value::STRING? error->string : "error");
+                //else
+                return *message;
+            }
+            //else
+            char buf[4096];
+            auto n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) throw std::runtime_error("Connection closed");
+            //else
+            in.append(buf, n);
+        }
+    }
+
+    json::Value call(const std::string& method, const std::string& parameters_json = "{}")
+    {
+        send_call(method, parameters_json);
+        auto reply = receive();
+        if (auto parameters = reply.get("parameters")) return *parameters;
+        //else
+        json::Value empty;
+        empty.type = json::Value::OBJECT;
+        return empty;
+    }
+};
+
+} // namespace varlink
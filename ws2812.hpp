@@ -0,0 +1,100 @@
+/**
+ * LED Indicator - WS2812 bitstream encoding for SPI
+ * Copyright (c) 2024 Tomoatsu Shimada/Walbrix Corporation
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// WS2812 pixels are driven from SPI MOSI at 3.2MHz, where every data bit becomes four SPI bits:
+// 1 -> 1110 (0.94us high), 0 -> 1000 (0.31us high).  Every data byte therefore expands to four SPI bytes,
+// one per pair of data bits, taken from a precomputed table.  A frame is the GRB bytes of all pixels
+// followed by enough zero bytes to latch (>280us low).
+namespace ws2812 {
+
+constexpr uint32_t spi_speed_hz = 3200000;
+constexpr size_t reset_bytes = 120;  // 300us at 3.2MHz
+
+// one SPI byte per pair of data bits
+constexpr uint8_t pair_table[4] = {0x88, 0x8e, 0xe8, 0xee};
+
+// four SPI bytes per data byte, most significant bits first
+inline const std::array<std::array<uint8_t, 4>, 256>& byte_table()
+{
+    static const auto table = []() {
+        std::array<std::array<uint8_t, 4>, 256> t;
+        for (int v = 0; v < 256; v++) {
+            for (int k = 0; k < 4; k++) t[v][k] = pair_table[(v >> (6 - 2 * k)) & 3];
+        }
+        return t;
+    }();
+    return table;
+}
+
+inline size_t encoded_size(size_t data_bytes) { return data_bytes * 4 + reset_bytes; }
+
+// scalar encoder using the per-byte lookup table
+inline void encode_scalar(const uint8_t* data, size_t size, uint8_t* out)
+{
+    const auto& table = byte_table();
+    for (size_t i = 0; i < size; i++) {
+        const auto& bytes = table[data[i]];
+        out[i * 4] = bytes[0];
+        out[i * 4 + 1] = bytes[1];
+        out[i * 4 + 2] = bytes[2];
+        out[i * 4 + 3] = bytes[3];
+    }
+}
+
+// encodes GRB data into out, which must hold encoded_size(size) bytes, including the trailing reset
+inline void encode(const uint8_t* data, size_t size, uint8_t* out)
+{
+    size_t i = 0;
+#if defined(__SSSE3__)
+    // 16 data bytes at a time: split every byte into its four bit pairs, look each pair up with pshufb and
+    // interleave the four results so that each data byte's SPI bytes end up adjacent
+    const __m128i table = _mm_setr_epi8(0x88, 0x8e, 0xe8, 0xee, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask = _mm_set1_epi8(3);
+    for (; i + 16 <= size; i += 16) {
+        auto v = _mm_loadu_si128((const __m128i*)(data + i));
+        auto p0 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 6), mask));
+        auto p1 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        auto p2 = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 2), mask));
+        auto p3 = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+        auto p01_lo = _mm_unpacklo_epi8(p0, p1), p01_hi = _mm_unpackhi_epi8(p0, p1);
+        auto p23_lo = _mm_unpacklo_epi8(p2, p3), p23_hi = _mm_unpackhi_epi8(p2, p3);
+        _mm_storeu_si128((__m128i*)(out + i * 4), _mm_unpacklo_epi16(p01_lo, p23_lo));
+        _mm_storeu_si128((__m128i*)(out + i * 4 + 16), _mm_unpackhi_epi16(p01_lo, p23_lo));
+        _mm_storeu_si128((__m128i*)(out + i * 4 + 32), _mm_unpacklo_epi16(p01_hi, p23_hi));
+        _mm_storeu_si128((__m128i*)(out + i * 4 + 48), _mm_unpackhi_epi16(p01_hi, p23_hi));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8_t table_init[16] = {0x88, 0x8e, 0xe8, 0xee};
+    const uint8x16_t table = vld1q_u8(table_init);
+    const uint8x16_t mask = vdupq_n_u8(3);
+    for (; i + 16 <= size; i += 16) {
+        auto v = vld1q_u8(data + i);
+        uint8x16x4_t pairs;
+        pairs.val[0] = vqtbl1q_u8(table, vshrq_n_u8(v, 6));
+        pairs.val[1] = vqtbl1q_u8(table, vandq_u8(vshrq_n_u8(v, 4), mask));
+        pairs.val[2] = vqtbl1q_u8(table, vandq_u8(vshrq_n_u8(v, 2), mask));
+        pairs.val[3] = vqtbl1q_u8(table, vandq_u8(v, mask));
+        vst4q_u8(out + i * 4, pairs);  // interleaving store
+    }
+#endif
+    encode_scalar(data + i, size - i, out + i * 4);
+    std::fill(out + size * 4, out + size * 4 + reset_bytes, 0);
+}
+
+} // namespace ws2812